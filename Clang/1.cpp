@@ -1,27 +1,233 @@
+// Build: g++ -std=c++17 -O2 -pthread 1.cpp -o scan
+// Prefix sums over spans: scalar inclusive and exclusive scans, an AVX2
+// in-register scan for 32- and 64-bit integers picked at run time, and a
+// two-pass blocked scan across threads for arrays of 10^8 elements and up.
+// "./scan bench [N] [THREADS]" times them against std::inclusive_scan.
 #include <iostream>
 #include <vector>
 #include <algorithm>
 #include <map>
 #include <string>
+#include <numeric>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+// A view of size elements at data. subspan() clamps to the view, so a scan
+// never touches memory outside the elements it was given.
+template <class T>
+struct Span {
+    T* data = nullptr;
+    size_t size = 0;
+
+    Span() {}
+    Span(T* data, size_t size) : data(data), size(size) {}
+    Span(vector<T>& v) : data(v.data()), size(v.size()) {}
+
+    T& operator[](size_t i) const { return data[i]; }
+    bool empty() const { return size == 0; }
+
+    Span subspan(size_t offset, size_t count) const {
+        offset = min(offset, size);
+        return Span(data + offset, min(count, size - offset));
+    }
+};
+
+// s[i] = carry + s[0] + ... + s[i]; returns the last value (carry when empty).
+// Sums must fit in T.
+template <class T>
+T inclusiveScan(Span<T> s, T carry = T()) {
+    for (T *p = s.data, *end = s.data + s.size; p != end; ++p) {
+        carry += *p;
+        *p = carry;
+    }
+    return carry;
+}
+
+// s[i] = init + s[0] + ... + s[i - 1]; returns the total, init plus every element.
+template <class T>
+T exclusiveScan(Span<T> s, T init = T()) {
+    for (T *p = s.data, *end = s.data + s.size; p != end; ++p) {
+        T value = *p;
+        *p = init;
+        init += value;
+    }
+    return init;
+}
+
+// The pairwise pass the original f() did: each element after the first gains
+// its original predecessor, walking backwards so every read sees an unmodified
+// value. Spans of fewer than two elements are left alone.
+template <class T>
+void addPredecessors(Span<T> s) {
+    for (size_t i = s.size; i-- > 1;) s[i] += s[i - 1];
+}
+
+// In-register scans: log2(lanes) shifted adds inside each 128-bit half, then
+// the low half's total is added to the high half and the running carry to
+// every lane. The tail is finished with the scalar loop.
+#if defined(__x86_64__) || defined(_M_X64)
+__attribute__((target("avx2"))) inline int32_t inclusiveScanAvx2(int32_t* data, size_t size, int32_t carry) {
+    __m256i sum = _mm256_set1_epi32(carry);
+    const __m256i last = _mm256_set1_epi32(7);
+    const __m256i lowLast = _mm256_set1_epi32(3);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+        __m256i low = _mm256_permutevar8x32_epi32(x, lowLast);
+        x = _mm256_add_epi32(x, _mm256_blend_epi32(_mm256_setzero_si256(), low, 0xf0));
+        x = _mm256_add_epi32(x, sum);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), x);
+        sum = _mm256_permutevar8x32_epi32(x, last);
+    }
+    carry = _mm256_cvtsi256_si32(sum);
+    return inclusiveScan(Span<int32_t>(data + i, size - i), carry);
+}
+
+__attribute__((target("avx2"))) inline int64_t inclusiveScanAvx2(int64_t* data, size_t size, int64_t carry) {
+    __m256i sum = _mm256_set1_epi64x(carry);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        x = _mm256_add_epi64(x, _mm256_slli_si256(x, 8));
+        __m256i low = _mm256_permute4x64_epi64(x, 0x55);
+        x = _mm256_add_epi64(x, _mm256_blend_epi32(_mm256_setzero_si256(), low, 0xf0));
+        x = _mm256_add_epi64(x, sum);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), x);
+        sum = _mm256_permute4x64_epi64(x, 0xff);
+    }
+    carry = _mm256_extract_epi64(sum, 0);
+    return inclusiveScan(Span<int64_t>(data + i, size - i), carry);
+}
+#endif
+
+inline bool haveAvx2() {
+#if defined(__x86_64__) || defined(_M_X64)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+// inclusiveScan using the AVX2 kernel when T is a 32- or 64-bit integer and
+// the CPU has it (unsigned types share the signed kernels: the bits of a sum
+// are the same); otherwise the scalar loop. Sums must fit in T.
+template <class T>
+T inclusiveScanSimd(Span<T> s, T carry = T()) {
+#if defined(__x86_64__) || defined(_M_X64)
+    if (haveAvx2()) {
+        if constexpr (is_integral<T>::value && sizeof(T) == 4) {
+            return T(inclusiveScanAvx2(reinterpret_cast<int32_t*>(s.data), s.size, int32_t(carry)));
+        } else if constexpr (is_integral<T>::value && sizeof(T) == 8) {
+            return T(inclusiveScanAvx2(reinterpret_cast<int64_t*>(s.data), s.size, int64_t(carry)));
+        }
+    }
+#endif
+    return inclusiveScan(s, carry);
+}
+
+// Below this many elements per thread the threads cost more than they save.
+const size_t MinParallelBlock = size_t(1) << 16;
+
+// Two-pass blocked scan: each thread sums its block, the block totals are
+// scanned serially into per-block carries, then each thread scans its block
+// from its carry. Every element is read twice and written once, and each
+// block is touched only by its own thread.
+template <class T>
+T parallelInclusiveScan(Span<T> s, int threads, T carry = T()) {
+    size_t blocks = min(size_t(max(threads, 1)), s.size / MinParallelBlock);
+    if (blocks <= 1) return inclusiveScanSimd(s, carry);
 
-void f(int p[], int size) {
-    int *a = &p[1];
-    for (int i = size-2; i >= 0; i--) {
-        a[i] += a[i-1];
+    size_t blockSize = (s.size + blocks - 1) / blocks;
+    vector<T> carries(blocks);
+    vector<thread> workers;
+    for (size_t b = 0; b < blocks; ++b) {
+        workers.emplace_back([&, b] {
+            Span<T> block = s.subspan(b * blockSize, blockSize);
+            carries[b] = accumulate(block.data, block.data + block.size, T());
+        });
     }
+    for (thread& w : workers) w.join();
+    T total = exclusiveScan(Span<T>(carries), carry);
+
+    workers.clear();
+    for (size_t b = 0; b < blocks; ++b) {
+        workers.emplace_back([&, b] { inclusiveScanSimd(s.subspan(b * blockSize, blockSize), carries[b]); });
+    }
+    for (thread& w : workers) w.join();
+    return total;
 }
 
-int main() {
+template <class Scan>
+double timeScan(Scan scan) {
+    auto start = chrono::steady_clock::now();
+    scan();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Scans the same random array with each implementation and checks them
+// against std::inclusive_scan.
+template <class T>
+bool benchScan(const char* type, size_t size, int threads) {
+    vector<T> input(size);
+    mt19937 rng(1);
+    for (T& x : input) x = T(rng() % 10);
+
+    vector<T> expected = input;
+    double reference = timeScan([&] { inclusive_scan(expected.begin(), expected.end(), expected.begin()); });
+    cout << "type=" << type << " scan=std::inclusive_scan seconds=" << reference
+         << " elements_per_sec=" << long(size / max(reference, 1e-9)) << "\n";
+
+    bool ok = true;
+    vector<T> data;
+    auto run = [&](const char* name, auto scan) {
+        data = input;
+        double seconds = timeScan([&] { scan(Span<T>(data)); });
+        bool same = data == expected;
+        ok &= same;
+        cout << "type=" << type << " scan=" << name << " seconds=" << seconds
+             << " elements_per_sec=" << long(size / max(seconds, 1e-9)) << " speedup=" << reference / max(seconds, 1e-9)
+             << " match=" << same << "\n";
+    };
+    run("scalar", [](Span<T> s) { inclusiveScan(s); });
+    run(haveAvx2() ? "avx2" : "simd_fallback", [](Span<T> s) { inclusiveScanSimd(s); });
+    run("parallel", [threads](Span<T> s) { parallelInclusiveScan(s, threads); });
+    return ok;
+}
+
+int runBench(int argc, char** argv) {
+    size_t size = argc > 2 ? size_t(atoll(argv[2])) : size_t(10000000);
+    int threads = argc > 3 ? atoi(argv[3]) : int(max(1u, thread::hardware_concurrency()));
+    cout << "elements=" << size << " threads=" << threads << "\n";
+    bool ok = benchScan<int32_t>("int32", size, threads);
+    ok &= benchScan<int64_t>("int64", size, threads);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) return runBench(argc, argv);
+
     int a[] = {6, 5, 4, 3, 2, 1};
 
-    int * q = &a[2];
-    f(q,3);
+    // What f(&a[2], 3) did: the three elements from a[2] on, with every one
+    // after the first gaining its predecessor.
+    addPredecessors(Span<int>(&a[2], 3));
 
     for (int i = 0; i < 6; i++) {
         cout << a[i] << " ";
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -1,20 +1,264 @@
 #include <iostream>
+#include <array>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
-int factorial(int n)
+// Factorials and binomials for counting game trees, three ways:
+//   - exact 64-bit values from a compile-time table, with overflow reported
+//   - modulo a prime, O(1) per nCr after precomputing (inverse) factorials
+//   - arbitrary precision, for exact values past 20!
+// Usage: exp                 reads n from stdin and prints n!
+//        exp choose N K [P]  prints C(N, K), modulo P if given
+
+const int MaxFactorial64 = 20;  // 21! does not fit in 64 bits
+
+constexpr std::array<uint64_t, MaxFactorial64 + 1> makeFactorialTable()
+{
+    std::array<uint64_t, MaxFactorial64 + 1> table{};
+    table[0] = 1;
+    for (int i = 1; i <= MaxFactorial64; ++i) {
+        table[i] = table[i - 1] * uint64_t(i);
+    }
+    return table;
+}
+
+constexpr std::array<uint64_t, MaxFactorial64 + 1> FactorialTable = makeFactorialTable();
+static_assert(FactorialTable[20] == 2432902008176640000ULL, "20! must be exact");
+
+// n! in out; false for negative n or when n! does not fit in 64 bits.
+bool factorial(int n, uint64_t& out)
+{
+    if (n < 0 || n > MaxFactorial64) {
+        return false;
+    }
+    out = FactorialTable[n];
+    return true;
+}
+
+// C(n, k) in out, built up as C(n - k + i, i) so every step divides exactly;
+// false for negative n or when the result does not fit in 64 bits.
+bool binomial(int n, int k, uint64_t& out)
 {
-    if (n == 0){
+    if (n < 0) {
+        return false;
+    }
+    if (k < 0 || k > n) {
+        out = 0;
+        return true;
+    }
+    if (k > n - k) {
+        k = n - k;
+    }
+    unsigned __int128 result = 1;
+    for (int i = 1; i <= k; ++i) {
+        result = result * uint64_t(n - k + i) / uint64_t(i);
+        if (result > UINT64_MAX) {
+            return false;
+        }
+    }
+    out = uint64_t(result);
+    return true;
+}
+
+// Factorials, inverse factorials and binomials modulo a prime p > maxN,
+// all tabulated once so choose() is two multiplications.
+class ModularCombinatorics {
+public:
+    ModularCombinatorics(int maxN, uint32_t p = 1000000007u)
+        : p(p), fact(maxN + 1), inverseFact(maxN + 1)
+    {
+        fact[0] = 1;
+        for (int i = 1; i <= maxN; ++i) {
+            fact[i] = fact[i - 1] * uint64_t(i) % p;
+        }
+        inverseFact[maxN] = power(fact[maxN], p - 2);
+        for (int i = maxN; i > 0; --i) {
+            inverseFact[i - 1] = inverseFact[i] * uint64_t(i) % p;
+        }
+    }
+
+    int maxN() const { return int(fact.size()) - 1; }
+    uint32_t modulus() const { return p; }
+
+    // Callers keep n within [0, maxN()].
+    uint64_t factorial(int n) const { return fact[n]; }
+    uint64_t inverseFactorial(int n) const { return inverseFact[n]; }
+
+    uint64_t choose(int n, int k) const
+    {
+        if (k < 0 || k > n) {
+            return 0;
+        }
+        return fact[n] * inverseFact[k] % p * inverseFact[n - k] % p;
+    }
+
+private:
+    uint64_t p;
+    std::vector<uint64_t> fact;
+    std::vector<uint64_t> inverseFact;
+
+    // base^e mod p; with p prime, base^(p-2) is the inverse of base (Fermat).
+    uint64_t power(uint64_t base, uint64_t e) const
+    {
+        uint64_t result = 1;
+        for (base %= p; e > 0; e >>= 1) {
+            if (e & 1) {
+                result = result * base % p;
+            }
+            base = base * base % p;
+        }
+        return result;
+    }
+};
+
+// Unsigned integer of any size, stored little-endian in base 10^9 limbs so
+// printing needs no division. Products and quotients by small factors are
+// all that factorials and binomials need.
+class BigUnsigned {
+public:
+    explicit BigUnsigned(uint32_t value = 0)
+    {
+        if (value > 0) {
+            limbs.push_back(value % Base);
+        }
+        if (value >= Base) {
+            limbs.push_back(value / Base);
+        }
+    }
+
+    void multiply(uint32_t factor)
+    {
+        uint64_t carry = 0;
+        for (uint32_t& limb : limbs) {
+            uint64_t product = uint64_t(limb) * factor + carry;
+            limb = uint32_t(product % Base);
+            carry = product / Base;
+        }
+        for (; carry > 0; carry /= Base) {
+            limbs.push_back(uint32_t(carry % Base));
+        }
+        trim();
+    }
+
+    // Divides in place and returns the remainder.
+    uint32_t divide(uint32_t divisor)
+    {
+        uint64_t remainder = 0;
+        for (size_t i = limbs.size(); i-- > 0;) {
+            uint64_t current = limbs[i] + remainder * Base;
+            limbs[i] = uint32_t(current / divisor);
+            remainder = current % divisor;
+        }
+        trim();
+        return uint32_t(remainder);
+    }
+
+    std::string toString() const
+    {
+        if (limbs.empty()) {
+            return "0";
+        }
+        std::string text = std::to_string(limbs.back());
+        for (size_t i = limbs.size() - 1; i-- > 0;) {
+            std::string limb = std::to_string(limbs[i]);
+            text += std::string(9 - limb.size(), '0') + limb;
+        }
+        return text;
+    }
+
+private:
+    static const uint32_t Base = 1000000000u;
+    std::vector<uint32_t> limbs;
+
+    void trim()
+    {
+        while (!limbs.empty() && limbs.back() == 0) {
+            limbs.pop_back();
+        }
+    }
+};
+
+// Exact n! for any n >= 0.
+BigUnsigned bigFactorial(int n)
+{
+    BigUnsigned result(1);
+    for (int i = 2; i <= n; ++i) {
+        result.multiply(uint32_t(i));
+    }
+    return result;
+}
+
+// Exact C(n, k) for any n >= 0; each step is C(n - k + i, i), so it divides exactly.
+BigUnsigned bigBinomial(int n, int k)
+{
+    if (k < 0 || k > n) {
+        return BigUnsigned(0);
+    }
+    if (k > n - k) {
+        k = n - k;
+    }
+    BigUnsigned result(1);
+    for (int i = 1; i <= k; ++i) {
+        result.multiply(uint32_t(n - k + i));
+        result.divide(uint32_t(i));
+    }
+    return result;
+}
+
+int runChoose(int argc, char** argv)
+{
+    if (argc < 4) {
+        std::cout << "usage: exp choose N K [P]" << std::endl;
         return 1;
+    }
+    int n = atoi(argv[2]), k = atoi(argv[3]);
+    if (n < 0) {
+        std::cout << "N must not be negative." << std::endl;
+        return 1;
+    }
+    if (argc > 4) {
+        long long p = atoll(argv[4]);
+        if (p <= n || p > UINT32_MAX) {
+            std::cout << "P must be a prime greater than N and below 2^32." << std::endl;
+            return 1;
+        }
+        std::cout << ModularCombinatorics(n, uint32_t(p)).choose(n, k) << std::endl;
+        return 0;
+    }
+    uint64_t value;
+    if (binomial(n, k, value)) {
+        std::cout << value << std::endl;
     } else {
-        return n * factorial(n - 1);
+        std::cout << bigBinomial(n, k).toString() << std::endl;
     }
+    return 0;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    if (argc > 1 && strcmp(argv[1], "choose") == 0) {
+        return runChoose(argc, argv);
+    }
+
     int num;
-    std::cin >> num;
-    
-    std::cout << factorial(num) << std::endl;
+    if (!(std::cin >> num)) {
+        std::cout << "Expected an integer." << std::endl;
+        return 1;
+    }
+    if (num < 0) {
+        std::cout << "Factorial is undefined for negative numbers." << std::endl;
+        return 1;
+    }
+
+    uint64_t value;
+    if (factorial(num, value)) {
+        std::cout << value << std::endl;
+    } else {
+        std::cout << bigFactorial(num).toString() << std::endl;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,246 +1,4104 @@
+// Build: g++ -std=c++17 -O2 -pthread Main.cpp -o Main  (add -DTTT_INSTRUMENT for stats=PATH counters)
 #include <iostream>
+#include <fstream>
 #include <vector>
 #include <cstdlib>
 #include <ctime>
 #include <string>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include <charconv>
+#include <iterator>
+#include <cerrno>
+#include <csignal>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#include <x86intrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 using namespace std;
 
+// Bump allocator over one heap block for trivially copyable arrays. Every
+// slice starts on a max_align_t boundary and footprint() tells owners how
+// much to reserve up front. Requests past the block are served from overflow
+// blocks that live until reset(), which then regrows the block to the peak
+// so the next round fits in one allocation again. The block starts zeroed,
+// padding included, so equal states compare equal byte for byte.
+class BumpArena {
+public:
+    static const size_t Align = alignof(max_align_t);
+
+    explicit BumpArena(size_t bytes = 0) : capacity(0), used(0), peak(0) { grow(bytes); }
+
+    template <class T>
+    static size_t footprint(size_t count) { return (count * sizeof(T) + Align - 1) & ~(Align - 1); }
+
+    template <class T>
+    T* allocate(size_t count) {
+        static_assert(is_trivially_copyable<T>::value, "arena slices are never constructed or destroyed");
+        size_t bytes = footprint<T>(count);
+        used += bytes;
+        peak = max(peak, used);
+        if (used <= capacity) return reinterpret_cast<T*>(data() + used - bytes);
+        overflow.emplace_back(new max_align_t[bytes / sizeof(max_align_t) + 1]);
+        return reinterpret_cast<T*>(overflow.back().get());
+    }
+
+    // Releases every slice at once.
+    void reset() {
+        if (!overflow.empty()) {
+            overflow.clear();
+            grow(peak);
+        }
+        used = 0;
+    }
+
+    unsigned char* data() { return reinterpret_cast<unsigned char*>(block.get()); }
+    const unsigned char* data() const { return reinterpret_cast<const unsigned char*>(block.get()); }
+    size_t size() const { return min(used, capacity); }
+
+private:
+    unique_ptr<max_align_t[]> block;
+    vector<unique_ptr<max_align_t[]> > overflow;
+    size_t capacity;
+    size_t used;
+    size_t peak;
+
+    void grow(size_t bytes) {
+        if (bytes <= capacity) return;
+        block.reset(new max_align_t[bytes / sizeof(max_align_t) + 1]);
+        capacity = footprint<unsigned char>(bytes);
+        memset(block.get(), 0, capacity);
+    }
+};
+
+// Contiguous storage for the n x n grid of n x n sub-grids.
+// Layout is sub-grid-major: sub-grid (mainX, mainY) is the run of n*n cells
+// starting at (mainX * n + mainY) * n * n, and within it cell (subX, subY)
+// sits at subX * n + subY. Whole sub-grids therefore share cache lines.
+// The cells live in `arena`, which must outlive the board.
+class FlatBoard {
+public:
+    FlatBoard(int n, char fill, BumpArena& arena)
+        : n(n), gridStride(n * n), total(n * n * n * n), cells(arena.allocate<char>(total)) {
+        this->fill(fill);
+    }
+
+    static size_t footprint(int n) { return BumpArena::footprint<char>(size_t(n) * n * n * n); }
+
+    int size() const { return n; }
+    int stride() const { return gridStride; }
+
+    int gridIndex(int mainX, int mainY) const { return mainX * n + mainY; }
+    int cellIndex(int subX, int subY) const { return subX * n + subY; }
+
+    const char* grid(int g) const { return &cells[g * gridStride]; }
+    char* grid(int g) { return &cells[g * gridStride]; }
+
+    char at(int g, int c) const { return cells[g * gridStride + c]; }
+    void set(int g, int c, char value) { cells[g * gridStride + c] = value; }
+
+    char at(int mainX, int mainY, int subX, int subY) const {
+        return at(gridIndex(mainX, mainY), cellIndex(subX, subY));
+    }
+    void set(int mainX, int mainY, int subX, int subY, char value) {
+        set(gridIndex(mainX, mainY), cellIndex(subX, subY), value);
+    }
+
+    void fill(char value) { std::fill(cells, cells + total, value); }
+
+private:
+    int n;
+    int gridStride;
+    int total;
+    char* cells;
+};
+
+// Same cells and accessor API as FlatBoard, packed two bits per cell
+// ('.' = 0, 'X' = 1, 'O' = 2) in the same sub-grid-major order: 32 cells per
+// word, a quarter of the char board's footprint. Meant for big boards and for
+// keeping many positions around; there is no grid() pointer access.
+class PackedBoard {
+public:
+    PackedBoard(int n, char fill) : n(n), gridStride(n * n), words((n * n * n * n + 31) / 32, 0) {
+        this->fill(fill);
+    }
+
+    explicit PackedBoard(const FlatBoard& board) : PackedBoard(board.size(), '.') {
+        int total = n * n * n * n;
+        const char* cells = board.grid(0);
+        for (int i = 0; i < total; ++i) setIndex(i, cells[i]);
+    }
+
+    int size() const { return n; }
+    int stride() const { return gridStride; }
+    size_t bytes() const { return words.size() * sizeof(uint64_t); }
+
+    int gridIndex(int mainX, int mainY) const { return mainX * n + mainY; }
+    int cellIndex(int subX, int subY) const { return subX * n + subY; }
+
+    char at(int g, int c) const { return atIndex(g * gridStride + c); }
+    void set(int g, int c, char value) { setIndex(g * gridStride + c, value); }
+
+    char at(int mainX, int mainY, int subX, int subY) const {
+        return at(gridIndex(mainX, mainY), cellIndex(subX, subY));
+    }
+    void set(int mainX, int mainY, int subX, int subY, char value) {
+        set(gridIndex(mainX, mainY), cellIndex(subX, subY), value);
+    }
+
+    void fill(char value) {
+        uint64_t code = encode(value);
+        uint64_t pattern = 0;
+        for (int i = 0; i < 32; ++i) pattern |= code << (2 * i);
+        std::fill(words.begin(), words.end(), pattern);
+    }
+
+    // Expands back into a char board of the same size.
+    void unpack(FlatBoard& board) const {
+        int total = n * n * n * n;
+        char* cells = board.grid(0);
+        for (int i = 0; i < total; ++i) cells[i] = atIndex(i);
+    }
+
+private:
+    int n;
+    int gridStride;
+    vector<uint64_t> words;
+
+    static uint64_t encode(char value) { return value == 'X' ? 1 : value == 'O' ? 2 : 0; }
+
+    char atIndex(int i) const {
+        static const char symbols[4] = {'.', 'X', 'O', '.'};
+        return symbols[(words[i >> 5] >> ((i & 31) * 2)) & 3];
+    }
+
+    void setIndex(int i, char value) {
+        uint64_t& word = words[i >> 5];
+        int shift = (i & 31) * 2;
+        word = (word & ~(uint64_t(3) << shift)) | encode(value) << shift;
+    }
+};
+
+// Precomputed line masks for an n x n grid held one bit per cell (row-major),
+// packed into ceil(n*n / 64) words. The lines are the n rows, the n columns
+// and both diagonals. For n <= 8 a grid fits in a single uint64_t.
+class LineMasks {
+public:
+    LineMasks(int n, BumpArena& arena)
+        : words((n * n + 63) / 64), lines(2 * n + 2), masks(arena.allocate<uint64_t>(lines * words)) {
+        std::fill(masks, masks + lines * words, 0);
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                setBit(i, i * n + j);              // row i
+                setBit(n + i, j * n + i);          // column i
+            }
+            setBit(2 * n, i * n + i);              // main diagonal
+            setBit(2 * n + 1, i * n + (n - 1 - i)); // anti-diagonal
+        }
+    }
+
+    static size_t footprint(int n) { return BumpArena::footprint<uint64_t>(size_t(2 * n + 2) * ((n * n + 63) / 64)); }
+
+    int wordsPerGrid() const { return words; }
+
+    // True if some line is fully set in the grid starting at bits.
+    bool anyComplete(const uint64_t* bits) const {
+        if (words == 1) {
+            uint64_t b = bits[0];
+            for (int l = 0; l < lines; ++l) {
+                if ((b & masks[l]) == masks[l]) return true;
+            }
+            return false;
+        }
+        for (int l = 0; l < lines; ++l) {
+            const uint64_t* m = &masks[l * words];
+            uint64_t missing = 0;
+            for (int w = 0; w < words; ++w) missing |= m[w] & ~bits[w];
+            if (missing == 0) return true;
+        }
+        return false;
+    }
+
+private:
+    int words;
+    int lines;
+    uint64_t* masks;
+
+    void setBit(int line, int cell) { masks[line * words + (cell >> 6)] |= uint64_t(1) << (cell & 63); }
+};
+
+// One bitmask per player for each of `grids` n x n grids, laid out like LineMasks.
+class BitBoard {
+public:
+    BitBoard(int n, int grids, BumpArena& arena)
+        : words((n * n + 63) / 64), grids(grids), bits(arena.allocate<uint64_t>(2 * grids * words)) {
+        std::fill(bits, bits + 2 * grids * words, 0);
+    }
+
+    static size_t footprint(int n, int grids) { return BumpArena::footprint<uint64_t>(size_t(2) * grids * ((n * n + 63) / 64)); }
+
+    const uint64_t* grid(int player, int g) const { return &bits[(player * grids + g) * words]; }
+
+    void set(int player, int g, int c) { bits[(player * grids + g) * words + (c >> 6)] |= uint64_t(1) << (c & 63); }
+    void clear(int player, int g, int c) { bits[(player * grids + g) * words + (c >> 6)] &= ~(uint64_t(1) << (c & 63)); }
+
+private:
+    int words;
+    int grids;
+    uint64_t* bits;
+};
+
+// `segments` independent sets over the values 0..capacity-1, each packed at the
+// front of its slice of `items`; `slot` maps a value to its position. Insert,
+// erase and picking the i-th member are O(1). erase() leaves the value's old
+// position in `slot`, so restore() undoes the latest erase exactly, keeping
+// the member order (and so any seeded random picks) identical after an undo.
+class IndexSets {
+public:
+    IndexSets(int segments, int capacity, BumpArena& arena)
+        : capacity(capacity), items(arena.allocate<int>(segments * capacity)),
+          slot(arena.allocate<int>(segments * capacity)), sizes(arena.allocate<int>(segments)) {
+        for (int s = 0; s < segments; ++s) {
+            for (int v = 0; v < capacity; ++v) {
+                items[s * capacity + v] = v;
+                slot[s * capacity + v] = v;
+            }
+            sizes[s] = capacity;
+        }
+    }
+
+    static size_t footprint(int segments, int capacity) {
+        return 2 * BumpArena::footprint<int>(size_t(segments) * capacity) + BumpArena::footprint<int>(segments);
+    }
+
+    int size(int s) const { return sizes[s]; }
+    int at(int s, int i) const { return items[s * capacity + i]; }
+    const int* members(int s) const { return &items[s * capacity]; }
+
+    bool contains(int s, int v) const {
+        int p = slot[s * capacity + v];
+        return p < sizes[s] && items[s * capacity + p] == v;
+    }
+
+    void erase(int s, int v) {
+        int* base = &items[s * capacity];
+        int* where = &slot[s * capacity];
+        int p = where[v];
+        int last = base[--sizes[s]];
+        base[p] = last;
+        where[last] = p;
+        base[sizes[s]] = v;
+        where[v] = p;
+    }
+
+    // Re-inserts v at the position erase() took it from; calls must mirror
+    // erases in reverse (LIFO) order.
+    void restore(int s, int v) {
+        int* base = &items[s * capacity];
+        int* where = &slot[s * capacity];
+        int p = where[v];
+        int moved = base[p];
+        base[sizes[s]] = moved;
+        where[moved] = sizes[s]++;
+        base[p] = v;
+        where[v] = p;
+    }
+
+private:
+    int capacity;
+    int* items;
+    int* slot;
+    int* sizes;
+};
+
+// How checkWin/checkMainGridWin detect a completed line. Only full-line rules
+// use it; a WinRule with shorter runs always checks runThrough() the last move.
+enum class WinCheck {
+    Scan,       // rescan the char cells
+    Bitboard,   // AND the player's bitmask against the precomputed line masks
+    Counters    // per-line stone counters, updated by each move; O(1) per check
+};
+
+// Scans every row, column and diagonal of the n x n grid `g` (row-major) for
+// one held entirely by `player`. With N > 0 the size is a compile-time
+// constant, so the loops have fixed trip counts; N == 0 reads dynamicN.
+template <int N>
+bool scanLines(const char* g, int dynamicN, char player) {
+    const int n = N > 0 ? N : dynamicN;
+
+    // Check rows
+    for (int i = 0; i < n; ++i) {
+        bool win = true;
+        for (int j = 0; j < n; ++j) {
+            if (g[i * n + j] != player) {
+                win = false;
+                break;
+            }
+        }
+        if (win) return true;
+    }
+    
+    // Check columns
+    for (int j = 0; j < n; ++j) {
+        bool win = true;
+        for (int i = 0; i < n; ++i) {
+            if (g[i * n + j] != player) {
+                win = false;
+                break;
+            }
+        }
+        if (win) return true;
+    }
+    
+    // Check diagonals
+    bool win = true;
+    for (int i = 0; i < n; ++i) {
+        if (g[i * n + i] != player) {
+            win = false;
+            break;
+        }
+    }
+    if (win) return true;
+    
+    win = true;
+    for (int i = 0; i < n; ++i) {
+        if (g[i * n + (n - 1 - i)] != player) {
+            win = false;
+            break;
+        }
+    }
+    return win;
+}
+
+// Both diagonals of the n x n grid `g`; the SIMD kernels below leave these
+// O(n) walks scalar.
+inline bool diagonalsComplete(const char* g, int n, char player) {
+    bool main = true, anti = true;
+    for (int i = 0; i < n; ++i) {
+        main &= g[i * n + i] == player;
+        anti &= g[i * n + (n - 1 - i)] == player;
+    }
+    return main || anti;
+}
+
+// How many in a row win: cellRun stones win a sub-grid, gridRun won sub-grids
+// win the game. 0 (or anything above n) means a full line of n, the classic rule.
+struct WinRule {
+    int cellRun = 0;
+    int gridRun = 0;
+
+    // The same rule with both runs spelled out in 1..n.
+    WinRule resolved(int n) const {
+        return WinRule{cellRun > 0 && cellRun < n ? cellRun : n, gridRun > 0 && gridRun < n ? gridRun : n};
+    }
+    bool sameAs(const WinRule& other, int n) const {
+        WinRule a = resolved(n), b = other.resolved(n);
+        return a.cellRun == b.cellRun && a.gridRun == b.gridRun;
+    }
+};
+
+// Does the run through (x, y) of the n x n grid `g` (row-major) reach k cells of
+// `player`, counting (x, y) itself as the player's? Walks at most k - 1 cells
+// each way along the row, column and both diagonals, so it is O(k) per call and
+// independent of how the rest of the grid looks.
+inline bool runThrough(const char* g, int n, int k, int x, int y, char player) {
+    static const int dx[4] = {0, 1, 1, 1};
+    static const int dy[4] = {1, 0, 1, -1};
+    for (int d = 0; d < 4; ++d) {
+        int run = 1;
+        for (int s = 1; s < k && run < k; ++s) {
+            int a = x + s * dx[d], b = y + s * dy[d];
+            if (a < 0 || b < 0 || a >= n || b >= n || g[a * n + b] != player) break;
+            ++run;
+        }
+        for (int s = 1; s < k && run < k; ++s) {
+            int a = x - s * dx[d], b = y - s * dy[d];
+            if (a < 0 || b < 0 || a >= n || b >= n || g[a * n + b] != player) break;
+            ++run;
+        }
+        if (run >= k) return true;
+    }
+    return false;
+}
+
+// Vector versions of scanLines for n >= 16. Each row is compared with the
+// player byte in 16- or 32-byte chunks (the last chunk overlaps the previous one,
+// so nothing is read past the row). A row wins if every lane matched; the
+// per-chunk matches are ANDed down the rows, so a set lane at the end is a
+// full column. Grids wider than MaxSimdChunks chunks use the scalar scan.
+const int MaxSimdChunks = 16;
+
+#if defined(__x86_64__) || defined(_M_X64)
+inline bool scanLinesSse2(const char* g, int n, char player) {
+    const int chunks = (n + 15) / 16;
+    if (n < 16 || chunks > MaxSimdChunks) return scanLines<0>(g, n, player);
+    const __m128i p = _mm_set1_epi8(player);
+    __m128i cols[MaxSimdChunks];
+    for (int k = 0; k < chunks; ++k) cols[k] = _mm_set1_epi8(-1);
+
+    for (int i = 0; i < n; ++i) {
+        const char* row = g + i * n;
+        bool full = true;
+        for (int k = 0; k < chunks; ++k) {
+            int offset = k == chunks - 1 ? n - 16 : k * 16;
+            __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + offset)), p);
+            cols[k] = _mm_and_si128(cols[k], eq);
+            full &= _mm_movemask_epi8(eq) == 0xffff;
+        }
+        if (full) return true;
+    }
+    for (int k = 0; k < chunks; ++k) {
+        if (_mm_movemask_epi8(cols[k]) != 0) return true;
+    }
+    return diagonalsComplete(g, n, player);
+}
+
+__attribute__((target("avx2"))) inline bool scanLinesAvx2(const char* g, int n, char player) {
+    const int chunks = (n + 31) / 32;
+    if (n < 32 || chunks > MaxSimdChunks) return scanLinesSse2(g, n, player);
+    const __m256i p = _mm256_set1_epi8(player);
+    __m256i cols[MaxSimdChunks];
+    for (int k = 0; k < chunks; ++k) cols[k] = _mm256_set1_epi8(-1);
+
+    for (int i = 0; i < n; ++i) {
+        const char* row = g + i * n;
+        bool full = true;
+        for (int k = 0; k < chunks; ++k) {
+            int offset = k == chunks - 1 ? n - 32 : k * 32;
+            __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + offset)), p);
+            cols[k] = _mm256_and_si256(cols[k], eq);
+            full &= _mm256_movemask_epi8(eq) == -1;
+        }
+        if (full) return true;
+    }
+    for (int k = 0; k < chunks; ++k) {
+        if (_mm256_movemask_epi8(cols[k]) != 0) return true;
+    }
+    return diagonalsComplete(g, n, player);
+}
+#elif defined(__aarch64__)
+inline bool scanLinesNeon(const char* g, int n, char player) {
+    const int chunks = (n + 15) / 16;
+    if (n < 16 || chunks > MaxSimdChunks) return scanLines<0>(g, n, player);
+    const uint8x16_t p = vdupq_n_u8(uint8_t(player));
+    uint8x16_t cols[MaxSimdChunks];
+    for (int k = 0; k < chunks; ++k) cols[k] = vdupq_n_u8(0xff);
+
+    for (int i = 0; i < n; ++i) {
+        const uint8_t* row = reinterpret_cast<const uint8_t*>(g + i * n);
+        bool full = true;
+        for (int k = 0; k < chunks; ++k) {
+            int offset = k == chunks - 1 ? n - 16 : k * 16;
+            uint8x16_t eq = vceqq_u8(vld1q_u8(row + offset), p);
+            cols[k] = vandq_u8(cols[k], eq);
+            full &= vminvq_u8(eq) == 0xff;
+        }
+        if (full) return true;
+    }
+    for (int k = 0; k < chunks; ++k) {
+        if (vmaxvq_u8(cols[k]) != 0) return true;
+    }
+    return diagonalsComplete(g, n, player);
+}
+#endif
+
+// Best rescan kernel this CPU supports for n >= 16.
+inline bool (*simdScanKernel())(const char*, int, char) {
+#if defined(__x86_64__) || defined(_M_X64)
+    return __builtin_cpu_supports("avx2") ? &scanLinesAvx2 : &scanLinesSse2;
+#elif defined(__aarch64__)
+    return &scanLinesNeon;
+#else
+    return &scanLines<0>;
+#endif
+}
+
+// LineMasks for a compile-time N <= 8, where a grid is a single word.
+template <int N>
+constexpr array<uint64_t, 2 * N + 2> fixedLineMasks() {
+    array<uint64_t, 2 * N + 2> masks{};
+    for (int i = 0; i < N; ++i) {
+        for (int j = 0; j < N; ++j) {
+            masks[i] |= uint64_t(1) << (i * N + j);
+            masks[N + i] |= uint64_t(1) << (j * N + i);
+        }
+        masks[2 * N] |= uint64_t(1) << (i * N + i);
+        masks[2 * N + 1] |= uint64_t(1) << (i * N + (N - 1 - i));
+    }
+    return masks;
+}
+
+template <int N>
+bool bitsComplete(const uint64_t* bits, const LineMasks& masks) {
+    if constexpr (N == 0) {
+        return masks.anyComplete(bits);
+    } else {
+        static constexpr array<uint64_t, 2 * N + 2> lines = fixedLineMasks<N>();
+        uint64_t b = bits[0];
+        for (uint64_t m : lines) {
+            if ((b & m) == m) return true;
+        }
+        return false;
+    }
+}
+
+// Full-rescan win checks, instantiated for the common sizes 4 through 8 and
+// picked once per engine from the runtime n. From n = 16 the char scan uses
+// the vector kernel chosen by CPU dispatch; other sizes use the N == 0 code.
+struct WinKernels {
+    bool (*scan)(const char* grid, int n, char player);
+    bool (*bits)(const uint64_t* bits, const LineMasks& masks);
+
+    static WinKernels forSize(int n) {
+        switch (n) {
+            case 4: return make<4>();
+            case 5: return make<5>();
+            case 6: return make<6>();
+            case 7: return make<7>();
+            case 8: return make<8>();
+            default: {
+                WinKernels kernels = make<0>();
+                if (n >= 16) kernels.scan = simdScanKernel();
+                return kernels;
+            }
+        }
+    }
+
+private:
+    template <int N>
+    static WinKernels make() { return WinKernels{&scanLines<N>, &bitsComplete<N>}; }
+};
+
+// Per-player stone counts for every row, column and diagonal of `grids`
+// n x n grids. Line l of grid g for player p is at ((g * 2 + p) * (2n + 2) + l);
+// rows are 0..n-1, columns n..2n-1, then the main and anti-diagonal.
+class LineCounters {
+public:
+    LineCounters(int n, int grids, BumpArena& arena)
+        : n(n), lines(2 * n + 2), counts(arena.allocate<uint16_t>(grids * 2 * lines)) {
+        std::fill(counts, counts + grids * 2 * lines, 0);
+    }
+
+    static size_t footprint(int n, int grids) { return BumpArena::footprint<uint16_t>(size_t(grids) * 2 * (2 * n + 2)); }
+
+    // Counts a stone at (x, y) on each line through it.
+    void add(int player, int g, int x, int y) {
+        uint16_t* c = &counts[(g * 2 + player) * lines];
+        ++c[x];
+        ++c[n + y];
+        if (x == y) ++c[2 * n];
+        if (x + y == n - 1) ++c[2 * n + 1];
+    }
+
+    void remove(int player, int g, int x, int y) {
+        uint16_t* c = &counts[(g * 2 + player) * lines];
+        --c[x];
+        --c[n + y];
+        if (x == y) --c[2 * n];
+        if (x + y == n - 1) --c[2 * n + 1];
+    }
+
+    int lineCount() const { return lines; }
+    int count(int player, int g, int line) const { return counts[(g * 2 + player) * lines + line]; }
+
+    // True if a stone at (x, y) would complete one of its lines for the player.
+    bool wouldComplete(int player, int g, int x, int y) const {
+        const uint16_t* c = &counts[(g * 2 + player) * lines];
+        return c[x] == n - 1 || c[n + y] == n - 1 || (x == y && c[2 * n] == n - 1) ||
+               (x + y == n - 1 && c[2 * n + 1] == n - 1);
+    }
+
+    // True if a line through (x, y) is complete for the player.
+    bool completes(int player, int g, int x, int y) const {
+        const uint16_t* c = &counts[(g * 2 + player) * lines];
+        return c[x] == n || c[n + y] == n || (x == y && c[2 * n] == n) || (x + y == n - 1 && c[2 * n + 1] == n);
+    }
+
+private:
+    int n;
+    int lines;
+    uint16_t* counts;
+};
+
+// Per-player stone counts for every run of k cells along a row, column or
+// diagonal (a window) of `grids` n x n grids, and how many windows of each grid
+// are still live: free of at least one player, so that player could yet fill
+// it. A grid with no live window can never be won. block() counts a cell for
+// both players, as a dead sub-grid is in the main grid. Each window packs the
+// X count in its low and the O count in its high 16 bits; the windows through
+// each cell (at most 4k) are listed once, at a fixed stride, in `tables`,
+// apart from the counts in `arena` since they never change.
+class LiveWindows {
+public:
+    LiveWindows(int n, int k, int grids, BumpArena& arena, BumpArena& tables)
+        : windows(windowCount(n, k)), stride(4 * k), counts(arena.allocate<uint32_t>(size_t(grids) * windows)),
+          liveCounts(arena.allocate<int>(grids)), through(tables.allocate<int>(n * n)),
+          ids(tables.allocate<int>(n * n * stride)) {
+        std::fill(counts, counts + size_t(grids) * windows, 0);
+        std::fill(liveCounts, liveCounts + grids, windows);
+        std::fill(through, through + n * n, 0);
+
+        static const int dx[4] = {0, 1, 1, 1};
+        static const int dy[4] = {1, 0, 1, -1};
+        int w = 0;
+        for (int d = 0; d < 4; ++d) {
+            for (int x = 0; x < n; ++x) {
+                for (int y = 0; y < n; ++y) {
+                    int endX = x + (k - 1) * dx[d], endY = y + (k - 1) * dy[d];
+                    if (endX >= n || endY < 0 || endY >= n) continue;
+                    for (int s = 0; s < k; ++s) {
+                        int cell = (x + s * dx[d]) * n + y + s * dy[d];
+                        ids[cell * stride + through[cell]++] = w;
+                    }
+                    ++w;
+                }
+            }
+        }
+    }
+
+    static size_t footprint(int n, int k, int grids) {
+        return BumpArena::footprint<uint32_t>(size_t(grids) * windowCount(n, k)) + BumpArena::footprint<int>(grids);
+    }
+
+    static size_t tableFootprint(int n, int k) {
+        return BumpArena::footprint<int>(n * n) + BumpArena::footprint<int>(n * n * 4 * k);
+    }
+
+    // Rows and columns have n - k + 1 windows per line, each diagonal direction (n - k + 1)^2.
+    static int windowCount(int n, int k) { return 2 * n * (n - k + 1) + 2 * (n - k + 1) * (n - k + 1); }
+
+    void add(int player, int g, int cell) {
+        uint32_t* c = &counts[size_t(g) * windows];
+        const int* w = &ids[cell * stride];
+        int own = 16 * player, other = 16 - own, change = 0;
+        for (int i = 0; i < through[cell]; ++i) {
+            uint32_t v = c[w[i]];
+            change += (((v >> own) & 0xffff) == 0) & (((v >> other) & 0xffff) != 0);
+            c[w[i]] = v + (1u << own);
+        }
+        liveCounts[g] -= change;
+    }
+
+    void remove(int player, int g, int cell) {
+        uint32_t* c = &counts[size_t(g) * windows];
+        const int* w = &ids[cell * stride];
+        int own = 16 * player, other = 16 - own, change = 0;
+        for (int i = 0; i < through[cell]; ++i) {
+            uint32_t v = c[w[i]] - (1u << own);
+            change += (((v >> own) & 0xffff) == 0) & (((v >> other) & 0xffff) != 0);
+            c[w[i]] = v;
+        }
+        liveCounts[g] += change;
+    }
+
+    void block(int g, int cell) {
+        add(0, g, cell);
+        add(1, g, cell);
+    }
+
+    void unblock(int g, int cell) {
+        remove(1, g, cell);
+        remove(0, g, cell);
+    }
+
+    int live(int g) const { return liveCounts[g]; }
+
+    int windowsPerGrid() const { return windows; }
+    int count(int player, int g, int w) const { return int((counts[size_t(g) * windows + w] >> (16 * player)) & 0xffff); }
+
+private:
+    int windows;      // per grid
+    int stride;
+    uint32_t* counts;
+    int* liveCounts;
+    int* through;     // windows through each cell
+    int* ids;         // through[cell] window numbers at cell * stride
+};
+
+// splitmix64 step; used to derive hash keys and seeds.
+inline uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// xoshiro256** (Blackman and Vigna): fast, small-state 64-bit generator.
+class Xoshiro256 {
+public:
+    explicit Xoshiro256(uint64_t value) { seed(value); }
+
+    void seed(uint64_t value) {
+        for (uint64_t& word : s) word = splitmix64(value);
+    }
+
+    uint64_t next() {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+private:
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+// PCG32 (O'Neill), XSH-RR output. next() joins two outputs so it can stand in
+// for Xoshiro256 anywhere a generator is a template parameter.
+class Pcg32 {
+public:
+    explicit Pcg32(uint64_t value, uint64_t stream = 0xda3e39cb94b95bdbULL) : inc((stream << 1) | 1) { seed(value); }
+
+    void seed(uint64_t value) {
+        state = 0;
+        next32();
+        state += value;
+        next32();
+    }
+
+    uint32_t next32() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+        uint32_t rot = uint32_t(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    uint64_t next() {
+        uint64_t high = next32();
+        return high << 32 | next32();
+    }
+
+private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// Unbiased draw from [0, bound) by Lemire's multiply-and-reject.
+template <class Rng>
+uint32_t uniformBelow(Rng& rng, uint32_t bound) {
+    uint64_t m = uint64_t(uint32_t(rng.next() >> 32)) * bound;
+    if (uint32_t(m) < bound) {
+        uint32_t threshold = uint32_t(-bound) % bound;
+        while (uint32_t(m) < threshold) m = uint64_t(uint32_t(rng.next() >> 32)) * bound;
+    }
+    return uint32_t(m >> 32);
+}
+
+// Event counters and per-phase timers for the engine's hot paths, compiled
+// in with -DTTT_INSTRUMENT and free otherwise. Each thread counts into its
+// own block, which snapshot() sums with the blocks of finished threads.
+// Timers read the cycle counter (rdtsc, cntvct_el0 on ARM) and are inclusive:
+// a search's time contains the win checks it made.
+class Instrumentation {
+public:
+    enum Counter { MovesApplied, InvalidMoves, WinChecks, MainGridChecks, GridsWon, CounterCount };
+    enum Phase { MoveGeneration, CheckWin, CheckMainGridWin, Search, Render, PhaseCount };
+
+    struct Totals {
+        uint64_t counts[CounterCount] = {};
+        uint64_t calls[PhaseCount] = {};
+        uint64_t ticks[PhaseCount] = {};
+
+        void add(const Totals& other) {
+            for (int c = 0; c < CounterCount; ++c) counts[c] += other.counts[c];
+            for (int p = 0; p < PhaseCount; ++p) {
+                calls[p] += other.calls[p];
+                ticks[p] += other.ticks[p];
+            }
+        }
+    };
+
+    static uint64_t ticks() {
+#if defined(__x86_64__) || defined(_M_X64)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t value;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+        return value;
+#else
+        return uint64_t(chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    static void count(Counter c) { local().bump(local().counts[c], 1); }
+    static void time(Phase p, uint64_t elapsed) {
+        Block& block = local();
+        block.bump(block.calls[p], 1);
+        block.bump(block.ticks[p], elapsed);
+    }
+
+    static Totals snapshot() {
+        Registry& registry = shared();
+        lock_guard<mutex> guard(registry.lock);
+        Totals totals = registry.retired;
+        for (const Block* block : registry.live) totals.add(block->read());
+        return totals;
+    }
+
+    // Writes the snapshot as one JSON object; "ns" uses the tick rate
+    // measured since the first event.
+    static void writeJson(ostream& out) {
+        static const char* counterNames[CounterCount] = {"moves_applied", "invalid_moves", "win_checks",
+                                                         "main_grid_checks", "grids_won"};
+        static const char* phaseNames[PhaseCount] = {"move_generation", "check_win", "check_main_grid_win",
+                                                     "search", "render"};
+        Totals totals = snapshot();
+        Registry& registry = shared();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - registry.startTime).count();
+        double ticksPerNs = seconds > 0 ? double(ticks() - registry.startTicks) / (seconds * 1e9) : 0;
+
+#ifdef TTT_INSTRUMENT
+        out << "{\"enabled\":true,\"counters\":{";
+#else
+        out << "{\"enabled\":false,\"counters\":{";
+#endif
+        for (int c = 0; c < CounterCount; ++c) out << (c ? "," : "") << '"' << counterNames[c] << "\":" << totals.counts[c];
+        out << "},\"timers\":{";
+        for (int p = 0; p < PhaseCount; ++p) {
+            out << (p ? "," : "") << '"' << phaseNames[p] << "\":{\"calls\":" << totals.calls[p]
+                << ",\"ticks\":" << totals.ticks[p]
+                << ",\"ns\":" << uint64_t(ticksPerNs > 0 ? totals.ticks[p] / ticksPerNs : 0) << "}";
+        }
+        out << "},\"ticks_per_ns\":" << ticksPerNs << "}\n";
+    }
+
+    // Times its scope as phase p.
+    class Timer {
+    public:
+        explicit Timer(Phase p) : phase(p), start(ticks()) {}
+        ~Timer() { time(phase, ticks() - start); }
+
+    private:
+        Phase phase;
+        uint64_t start;
+    };
+
+private:
+    // Written only by its thread; relaxed atomics so snapshot() may read it meanwhile.
+    struct Block {
+        atomic<uint64_t> counts[CounterCount] = {};
+        atomic<uint64_t> calls[PhaseCount] = {};
+        atomic<uint64_t> ticks[PhaseCount] = {};
+
+        Block();
+        ~Block();
+
+        static void bump(atomic<uint64_t>& value, uint64_t by) {
+            value.store(value.load(memory_order_relaxed) + by, memory_order_relaxed);
+        }
+
+        Totals read() const {
+            Totals totals;
+            for (int c = 0; c < CounterCount; ++c) totals.counts[c] = counts[c].load(memory_order_relaxed);
+            for (int p = 0; p < PhaseCount; ++p) {
+                totals.calls[p] = calls[p].load(memory_order_relaxed);
+                totals.ticks[p] = ticks[p].load(memory_order_relaxed);
+            }
+            return totals;
+        }
+    };
+
+    struct Registry {
+        mutex lock;
+        vector<const Block*> live;
+        Totals retired;  // blocks of threads that have exited
+        chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+        uint64_t startTicks = Instrumentation::ticks();
+    };
+
+    static Registry& shared() {
+        static Registry registry;
+        return registry;
+    }
+
+    static Block& local() {
+        thread_local Block block;
+        return block;
+    }
+};
+
+inline Instrumentation::Block::Block() {
+    Registry& registry = shared();
+    lock_guard<mutex> guard(registry.lock);
+    registry.live.push_back(this);
+}
+
+inline Instrumentation::Block::~Block() {
+    Registry& registry = shared();
+    lock_guard<mutex> guard(registry.lock);
+    registry.retired.add(read());
+    registry.live.erase(find(registry.live.begin(), registry.live.end(), this));
+}
+
+#ifdef TTT_INSTRUMENT
+#define TTT_COUNT(counter) Instrumentation::count(Instrumentation::counter)
+#define TTT_TIME(phase) Instrumentation::Timer instrumentTimer(Instrumentation::phase)
+#else
+#define TTT_COUNT(counter) ((void)0)
+#define TTT_TIME(phase) ((void)0)
+#endif
+
+// Random 64-bit keys for Zobrist hashing: one per (cell, player) of the n^4
+// board, one per (sub-grid, winner), one per possible active grid and one for
+// "O to move". Keys are fixed per n, so hashes agree across engine instances.
+class ZobristKeys {
+public:
+    explicit ZobristKeys(int n, uint64_t seed = 0x5eed5eedULL)
+        : cells(2 * n * n * n * n), winners(2 * n * n), grids(n * n + 1) {
+        for (uint64_t& k : cells) k = splitmix64(seed);
+        for (uint64_t& k : winners) k = splitmix64(seed);
+        for (uint64_t& k : grids) k = splitmix64(seed);
+        side = splitmix64(seed);
+    }
+
+    // Shared key set for board size n.
+    static const ZobristKeys& forSize(int n) {
+        static mutex lock;
+        static map<int, unique_ptr<ZobristKeys> > bySize;
+        lock_guard<mutex> guard(lock);
+        unique_ptr<ZobristKeys>& keys = bySize[n];
+        if (!keys) keys.reset(new ZobristKeys(n));
+        return *keys;
+    }
+
+    uint64_t cell(int flat, int player) const { return cells[flat * 2 + player]; }
+    uint64_t winner(int g, int player) const { return winners[g * 2 + player]; }
+    uint64_t activeGrid(int g) const { return grids[g + 1]; }  // g == -1 is "any grid"
+    uint64_t oToMove() const { return side; }
+
+private:
+    vector<uint64_t> cells;
+    vector<uint64_t> winners;
+    vector<uint64_t> grids;
+    uint64_t side;
+};
+
+struct PlayOptions;
+class EngineBench;
+
+// A move names a sub-grid (mainX * n + mainY) and a cell inside it (subX * n + subY).
+struct Move {
+    int grid;
+    int cell;
+};
+
+// The 8 symmetries of the square, applied to the main grid and to every
+// sub-grid at once. image(t, i) is where index i = x * n + y of an n x n
+// grid goes under transform t; transform 0 is the identity.
+class Symmetries {
+public:
+    static const int Count = 8;
+
+    explicit Symmetries(int n) : n(n), table(Count * n * n), inverses(Count) {
+        for (int t = 0; t < Count; ++t) {
+            for (int x = 0; x < n; ++x) {
+                for (int y = 0; y < n; ++y) {
+                    int a = t & 4 ? y : x, b = t & 4 ? x : y;  // transpose
+                    if (t & 1) a = n - 1 - a;                  // flip rows
+                    if (t & 2) b = n - 1 - b;                  // flip columns
+                    table[t * n * n + x * n + y] = a * n + b;
+                }
+            }
+        }
+        for (int t = 0; t < Count; ++t) {
+            for (int u = 0; u < Count; ++u) {
+                bool identity = true;
+                for (int i = 0; i < n * n && identity; ++i) identity = image(u, image(t, i)) == i;
+                if (identity) inverses[t] = u;
+            }
+        }
+    }
+
+    static const Symmetries& forSize(int n) {
+        static mutex lock;
+        static map<int, unique_ptr<Symmetries> > bySize;
+        lock_guard<mutex> guard(lock);
+        unique_ptr<Symmetries>& symmetries = bySize[n];
+        if (!symmetries) symmetries.reset(new Symmetries(n));
+        return *symmetries;
+    }
+
+    int image(int t, int i) const { return table[t * n * n + i]; }
+    int inverse(int t) const { return inverses[t]; }
+    Move apply(int t, Move m) const { return Move{image(t, m.grid), image(t, m.cell)}; }
+
+private:
+    int n;
+    vector<int> table;
+    vector<int> inverses;
+};
+
+// One Zobrist key per symmetry; lane t belongs to the image under transform t.
+// A GCC/Clang vector type, so XORing all eight compiles to a few SIMD ops.
+typedef uint64_t KeyImages __attribute__((vector_size(8 * Symmetries::Count)));
+
+// Zobrist keys of every feature's 8 symmetric images, one cache line per
+// feature, so a state change updates all eight position keys at once.
+class SymmetricKeys {
+public:
+    explicit SymmetricKeys(int n) : cells(size_t(2) * n * n * n * n), winners(2 * n * n), grids(n * n + 1) {
+        const ZobristKeys& base = ZobristKeys::forSize(n);
+        const Symmetries& symmetry = Symmetries::forSize(n);
+        int grid = n * n;
+        for (int t = 0; t < Symmetries::Count; ++t) {
+            for (int g = 0; g < grid; ++g) {
+                int image = symmetry.image(t, g);
+                for (int c = 0; c < grid; ++c) {
+                    for (int p = 0; p < 2; ++p) {
+                        cells[(g * grid + c) * 2 + p][t] = base.cell(image * grid + symmetry.image(t, c), p);
+                    }
+                }
+                for (int p = 0; p < 2; ++p) winners[g * 2 + p][t] = base.winner(image, p);
+                grids[g + 1][t] = base.activeGrid(image);
+            }
+            grids[0][t] = base.activeGrid(-1);
+        }
+        side = base.oToMove();
+    }
+
+    static const SymmetricKeys& forSize(int n) {
+        static mutex lock;
+        static map<int, unique_ptr<SymmetricKeys> > bySize;
+        lock_guard<mutex> guard(lock);
+        unique_ptr<SymmetricKeys>& keys = bySize[n];
+        if (!keys) keys.reset(new SymmetricKeys(n));
+        return *keys;
+    }
+
+    const KeyImages& cell(int flat, int player) const { return cells[flat * 2 + player]; }
+    const KeyImages& winner(int g, int player) const { return winners[g * 2 + player]; }
+    const KeyImages& activeGrid(int g) const { return grids[g + 1]; }
+    uint64_t oToMove() const { return side; }  // the same in every image
+
+private:
+    vector<KeyImages> cells;
+    vector<KeyImages> winners;
+    vector<KeyImages> grids;
+    uint64_t side;
+};
+
+enum class GameStatus { InProgress, XWins, OWins, Draw };
+
+// What applyMove did with a move.
+enum class MoveResult { Invalid, Placed, GridWon, GameWon };
+
+// Everything needed to take back one applyMove. The game never holds more
+// than n^4 of these, so the stack is reserved once and never reallocates.
+struct UndoRecord {
+    int32_t grid;
+    int32_t cell;
+    int32_t prevActive;
+    char prevPlayer;
+    uint8_t flags;
+
+    enum : uint8_t {
+        GridWon = 1,     // mainGridWinners[grid] went from '.' to prevPlayer
+        GridDead = 2,    // the move left the grid unwinnable without winning it
+        GameOver = 4     // the move ended the game
+    };
+};
+
+// Board state and rules with no I/O. A game is driven by setActiveGrid() and
+// applyMove(); play() below is the interactive front-end on top of that.
+// A sub-grid is open while nobody has won it and one of its lines can still be
+// won; the game is drawn as soon as no line of the main grid can be.
+// All per-cell and per-grid arrays, undo stack last, share one heap block.
 class TicTacToe {
 public:
-    TicTacToe(int n) : n(n), currentPlayer('X') {
-        board.resize(n, vector<vector<char> >(n, vector<char>(n * n, '.')));
-        mainGridWinners.resize(n, vector<char>(n, '.'));
+    // Largest supported n. Memory grows as n^4 (128 n^4 bytes of symmetric
+    // keys alone, 128 MB at 32), and the int cell arithmetic overflows past 215.
+    static constexpr int MaxSize = 32;
+
+    TicTacToe(int n, WinCheck winCheck = WinCheck::Counters, uint64_t seed = 1, WinRule rule = WinRule())
+        : n(n), currentPlayer('X'), winCheck(winCheck), cellRun(rule.resolved(n).cellRun),
+          gridRun(rule.resolved(n).gridRun), tables(tableBytes(n, rule)), arena(stateBytes(n, rule)), board(n, '.', arena),
+          mainGridWinners(arena.allocate<char>(n * n)), lineMasks(n, tables), kernels(WinKernels::forSize(n)),
+          cellBits(n, n * n, arena), gridBits(n, 1, arena), cellLines(n, n * n, arena), gridLines(n, 1, arena),
+          cellWindows(n, cellRun, n * n, arena, tables), gridWindows(n, gridRun, 1, arena, tables),
+          emptyCells(n * n, n * n, arena), openGridSet(1, n * n, arena), active(-1), gameStatus(GameStatus::InProgress),
+          history(arena.allocate<UndoRecord>(n * n * n * n)), historySize(0), undoFloor(0),
+          keys(&SymmetricKeys::forSize(n)), symmetry(&Symmetries::forSize(n)), rng(seed) {
+        fill(mainGridWinners, mainGridWinners + n * n, '.');
+        key = keys->activeGrid(-1);
+    }
+
+    // Builds the same tables, lays out the same block and copies it in one go.
+    TicTacToe(const TicTacToe& other) : TicTacToe(other.n, other.winCheck, 1, other.rule()) {
+        memcpy(arena.data(), other.arena.data(), arena.size());
+        currentPlayer = other.currentPlayer;
+        active = other.active;
+        gameStatus = other.gameStatus;
+        historySize = other.historySize;
+        key = other.key;
+        rng = other.rng;
+    }
+    TicTacToe& operator=(const TicTacToe&) = delete;
+
+    // Bytes of the shared block for an n game under `rule`.
+    static size_t stateBytes(int n, WinRule rule) {
+        int grids = n * n;
+        rule = rule.resolved(n);
+        return FlatBoard::footprint(n) + BumpArena::footprint<char>(grids) +
+               BitBoard::footprint(n, grids) + BitBoard::footprint(n, 1) + LineCounters::footprint(n, grids) +
+               LineCounters::footprint(n, 1) + LiveWindows::footprint(n, rule.cellRun, grids) +
+               LiveWindows::footprint(n, rule.gridRun, 1) + IndexSets::footprint(grids, grids) + IndexSets::footprint(1, grids) +
+               BumpArena::footprint<UndoRecord>(size_t(grids) * grids);
+    }
+
+    // Bytes of the tables that depend only on n and `rule`.
+    static size_t tableBytes(int n, WinRule rule) {
+        rule = rule.resolved(n);
+        return LineMasks::footprint(n) + LiveWindows::tableFootprint(n, rule.cellRun) +
+               LiveWindows::tableFootprint(n, rule.gridRun);
+    }
+
+    // Back to the empty board, or to the moves fixHistory() kept, reusing every
+    // buffer; seeds the generator for the next game.
+    void reset(uint64_t seed) {
+        while (undoMove()) {}
+        setActiveGrid(-1);
+        rng.seed(seed);
+    }
+
+    // Fixed part of a snapshot. The block follows it up to the last live undo
+    // record, so the board, mainGridWinners and every count derived from them
+    // come back with one memcpy, and the restored game can still be undone.
+    // The constant tables are not part of it; the engine restoring has its own.
+    struct SnapshotHeader {
+        int32_t n;
+        int32_t cellRun;
+        int32_t gridRun;
+        int32_t active;
+        int32_t historySize;
+        uint8_t currentPlayer;
+        uint8_t gameStatus;
+        uint8_t reserved[2];
+        KeyImages key;
+        unsigned char rng[sizeof(Xoshiro256)];
+    };
+
+    size_t snapshotBytes() const { return sizeof(SnapshotHeader) + blockPrefix(historySize); }
+
+    // Writes snapshotBytes() bytes to out; plain bytes, safe to copy anywhere.
+    void snapshot(void* out) const {
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        header.n = n;
+        header.cellRun = cellRun;
+        header.gridRun = gridRun;
+        header.active = active;
+        header.historySize = historySize;
+        header.currentPlayer = uint8_t(currentPlayer);
+        header.gameStatus = uint8_t(gameStatus);
+        header.key = key;
+        memcpy(header.rng, &rng, sizeof(rng));
+        memcpy(out, &header, sizeof(header));
+        memcpy(static_cast<unsigned char*>(out) + sizeof(header), arena.data(), blockPrefix(historySize));
+    }
+
+    void snapshot(vector<uint8_t>& out) const {
+        out.resize(snapshotBytes());
+        snapshot(out.data());
+    }
+
+    // Takes on the snapshotted position; false, leaving this game untouched,
+    // if its header is malformed, from an engine with another n or rule, or
+    // shorter than the moves fixHistory() kept. The block is taken as written,
+    // so only restore what snapshot() wrote.
+    bool restore(const void* data, size_t bytes) {
+        SnapshotHeader header;
+        if (bytes < sizeof(header)) return false;
+        memcpy(&header, data, sizeof(header));
+        char toMove = header.historySize % 2 == 0 ? 'X' : 'O';
+        if (header.n != n || header.cellRun != cellRun || header.gridRun != gridRun || header.historySize < 0 ||
+            header.historySize < undoFloor || header.historySize > n * n * n * n || header.currentPlayer != toMove ||
+            header.active < -1 || header.active >= n * n || header.gameStatus > uint8_t(GameStatus::Draw) || bytes != sizeof(header) + blockPrefix(header.historySize)) {
+            return false;
+        }
+        memcpy(arena.data(), static_cast<const unsigned char*>(data) + sizeof(header), blockPrefix(header.historySize));
+        currentPlayer = char(header.currentPlayer);
+        active = header.active;
+        gameStatus = GameStatus(header.gameStatus);
+        historySize = header.historySize;
+        key = header.key;
+        memcpy(&rng, header.rng, sizeof(rng));
+        return true;
+    }
+
+    bool restore(const vector<uint8_t>& blob) { return restore(blob.data(), blob.size()); }
+
+    int size() const { return n; }
+    WinRule rule() const { return WinRule{cellRun, gridRun}; }
+    char toMove() const { return currentPlayer; }
+    GameStatus status() const { return gameStatus; }
+    int moveCount() const { return historySize; }
+    Move moveAt(int i) const { return Move{history[i].grid, history[i].cell}; }
+
+    // The sub-grid the side to move must play in, or -1 if any open grid is allowed.
+    int activeGrid() const { return active; }
+    void setActiveGrid(int g) {
+        if (g == active) return;
+        key ^= keys->activeGrid(active) ^ keys->activeGrid(g);
+        active = g;
+    }
+
+    // Zobrist key of the position: cells, sub-grid winners, side to move and
+    // active grid. Maintained incrementally by every state change.
+    uint64_t hash() const { return key[0]; }
+
+    // Smallest key over the 8 symmetric images of the position, and the
+    // transform that gives it. Symmetric positions share it, so caches keyed
+    // by it store one entry for all of them, with moves mapped by
+    // symmetries().apply(canonicalTransform(), m) on the way in and the
+    // inverse transform on the way out.
+    uint64_t canonicalHash() const { return key[canonicalTransform()]; }
+    uint64_t symmetricHash(int t) const { return key[t]; }
+    int canonicalTransform() const {
+        int best = 0;
+        for (int t = 1; t < Symmetries::Count; ++t) {
+            if (key[t] < key[best]) best = t;
+        }
+        return best;
+    }
+    const Symmetries& symmetries() const { return *symmetry; }
+
+    char cellAt(int mainX, int mainY, int subX, int subY) const { return board.at(mainX, mainY, subX, subY); }
+    const FlatBoard& cells() const { return board; }
+    char gridWinner(int mainX, int mainY) const { return mainGridWinners[mainX * n + mainY]; }
+    bool gridOpen(int g) const { return openGridSet.contains(0, g); }
+    int openGridCount() const { return openGridSet.size(0); }
+    int emptyCellCount(int g) const { return emptyCells.size(g); }
+
+    static int playerIndex(char player) { return player == 'X' ? 0 : 1; }
+
+    const LineCounters& subGridLines() const { return cellLines; }
+    const LineCounters& mainGridLines() const { return gridLines; }
+    const LiveWindows& subGridWindows() const { return cellWindows; }
+    const LiveWindows& mainGridWindows() const { return gridWindows; }
+
+    // True if playing m as `player` would win its sub-grid.
+    bool completesLine(Move m, char player) const {
+        if (cellRun < n) return runThrough(board.grid(m.grid), n, cellRun, m.cell / n, m.cell % n, player);
+        return cellLines.wouldComplete(playerIndex(player), m.grid, m.cell / n, m.cell % n);
+    }
+
+    bool isValidMove(int mainX, int mainY, int subX, int subY) const {
+        if (gridWinner(mainX, mainY) != '.') return false;
+        return subX >= 0 && subY >= 0 && subX < n && subY < n && board.at(mainX, mainY, subX, subY) == '.';
+    }
+
+    bool isLegal(Move m) const {
+        if (gameStatus != GameStatus::InProgress) return false;
+        if (m.grid < 0 || m.grid >= n * n || m.cell < 0 || m.cell >= n * n) return false;
+        if (active >= 0 && m.grid != active) return false;
+        return mainGridWinners[m.grid] == '.' && board.at(m.grid, m.cell) == '.';
+    }
+
+    // Fills `out` with every legal move; reuses its capacity between calls.
+    void legalMoves(vector<Move>& out) const {
+        TTT_TIME(MoveGeneration);
+        out.clear();
+        if (gameStatus != GameStatus::InProgress) return;
+        int first = active >= 0 ? active : 0;
+        int last = active >= 0 ? active + 1 : n * n;
+        for (int g = first; g < last; ++g) {
+            if (!gridOpen(g)) continue;
+            const int* cells = emptyCells.members(g);
+            for (int i = 0; i < emptyCells.size(g); ++i) out.push_back(Move{g, cells[i]});
+        }
+    }
+
+    // Same moves into a caller buffer of at least n^4 - moveCount() entries; returns the count.
+    int legalMoves(Move* out) const {
+        TTT_TIME(MoveGeneration);
+        if (gameStatus != GameStatus::InProgress) return 0;
+        int first = active >= 0 ? active : 0;
+        int last = active >= 0 ? active + 1 : n * n;
+        int count = 0;
+        for (int g = first; g < last; ++g) {
+            if (!gridOpen(g)) continue;
+            const int* cells = emptyCells.members(g);
+            for (int i = 0; i < emptyCells.size(g); ++i) out[count++] = Move{g, cells[i]};
+        }
+        return count;
+    }
+
+    // The engine's own generator, used by drawActiveGrid() and the front-ends.
+    Xoshiro256& random() { return rng; }
+
+    // Uniformly random open sub-grid; the game must still be in progress.
+    // Untimed, since randomMove() and drawActiveGrid() time their calls to it.
+    template <class Rng>
+    int randomOpenGrid(Rng& rng) const {
+        return openGridSet.at(0, int(uniformBelow(rng, uint32_t(openGridSet.size(0)))));
+    }
+
+    // Makes a random open grid the active one, as play() does every turn.
+    template <class Rng>
+    void drawActiveGrid(Rng& rng) {
+        TTT_TIME(MoveGeneration);
+        setActiveGrid(randomOpenGrid(rng));
+    }
+    void drawActiveGrid() { drawActiveGrid(rng); }
+
+    // Uniformly random empty cell of the active grid, or of a random open grid
+    // when none is active; this is the move rule of play().
+    template <class Rng>
+    Move randomMove(Rng& rng) const {
+        TTT_TIME(MoveGeneration);
+        int g = active >= 0 ? active : randomOpenGrid(rng);
+        return Move{g, emptyCells.at(g, int(uniformBelow(rng, uint32_t(emptyCells.size(g)))))};
+    }
+
+    // Plays m for the side to move, then passes the turn and clears the active grid.
+    MoveResult applyMove(Move m) {
+        if (!isLegal(m)) {
+            TTT_COUNT(InvalidMoves);
+            return MoveResult::Invalid;
+        }
+        TTT_COUNT(MovesApplied);
+
+        int mainX = m.grid / n, mainY = m.grid % n;
+        int subX = m.cell / n, subY = m.cell % n;
+        MoveResult result = MoveResult::Placed;
+        UndoRecord record{m.grid, m.cell, active, currentPlayer, 0};
+
+        placeStone(mainX, mainY, subX, subY);
+        if (checkWin(mainX, mainY, subX, subY)) {
+            markGridWon(mainX, mainY);
+            record.flags |= UndoRecord::GridWon;
+            result = MoveResult::GridWon;
+            if (checkMainGridWin(mainX, mainY)) {
+                gameStatus = currentPlayer == 'X' ? GameStatus::XWins : GameStatus::OWins;
+                result = MoveResult::GameWon;
+            }
+        } else if (cellWindows.live(m.grid) == 0) {
+            markGridDead(m.grid);
+            record.flags |= UndoRecord::GridDead;
+        }
+        // Also true once no grid is open: each main-grid window then holds both players.
+        if (gameStatus == GameStatus::InProgress && gridWindows.live(0) == 0) gameStatus = GameStatus::Draw;
+        if (gameStatus != GameStatus::InProgress) record.flags |= UndoRecord::GameOver;
+
+        history[historySize++] = record;
+        togglePlayer();
+        setActiveGrid(-1);
+        return result;
+    }
+
+    // Makes the moves played so far permanent: undoMove() stops at them.
+    void fixHistory() { undoFloor = historySize; }
+
+    // Takes back the last applyMove, restoring the player, active grid and status.
+    bool undoMove() {
+        if (historySize == undoFloor) return false;
+        UndoRecord record = history[--historySize];
+
+        int mainX = record.grid / n, mainY = record.grid % n;
+        if (currentPlayer != record.prevPlayer) togglePlayer();
+        setActiveGrid(record.prevActive);
+        if (record.flags & UndoRecord::GameOver) gameStatus = GameStatus::InProgress;
+        if (record.flags & UndoRecord::GridWon) unmarkGridWon(mainX, mainY);
+        if (record.flags & UndoRecord::GridDead) unmarkGridDead(record.grid);
+        removeStone(mainX, mainY, record.cell / n, record.cell % n);
+        return true;
+    }
+
+    // Interactive front-end: hot-seat by default, or against the AI for options.aiSide.
+    void play(const PlayOptions& options);
+    void play();
+
+private:
+    friend class EngineBench;
+
+    int n;
+    char currentPlayer;
+    WinCheck winCheck;
+    int cellRun;                   // stones in a row that win a sub-grid, 1..n
+    int gridRun;                   // won sub-grids in a row that win the game, 1..n
+    BumpArena tables;              // the constant arrays: lineMasks, and where each window lies
+    BumpArena arena;               // owns the arrays of every other member below
+    FlatBoard board;
+    char* mainGridWinners;         // row-major n*n: '.' open, 'X'/'O' won, '-' dead (drawn)
+    LineMasks lineMasks;
+    WinKernels kernels;            // scan/bitboard checks specialized for n
+    BitBoard cellBits;             // bitboard mirror of board, one grid per sub-grid
+    BitBoard gridBits;             // bitboard mirror of mainGridWinners
+    LineCounters cellLines;        // per-line stone counts of every sub-grid
+    LineCounters gridLines;        // per-line counts of won sub-grids in the main grid
+    LiveWindows cellWindows;       // cellRun-windows of each sub-grid still winnable by someone
+    LiveWindows gridWindows;       // the same for the main grid; dead sub-grids block both players
+    IndexSets emptyCells;          // empty cells of each sub-grid
+    IndexSets openGridSet;         // sub-grids that are neither won nor dead
+    int active;
+    GameStatus gameStatus;
+    UndoRecord* history;           // n^4 entries, enough for a full game
+    int historySize;
+    int undoFloor;                 // moves undoMove() will not take back; see fixHistory()
+    const SymmetricKeys* keys;
+    const Symmetries* symmetry;
+    KeyImages key;                 // key[t] hashes the position mapped by transform t
+    Xoshiro256 rng;
+
+    void placeStone(int mainX, int mainY, int subX, int subY) {
+        board.set(mainX, mainY, subX, subY, currentPlayer);
+        int g = board.gridIndex(mainX, mainY);
+        cellBits.set(playerIndex(currentPlayer), g, board.cellIndex(subX, subY));
+        cellLines.add(playerIndex(currentPlayer), g, subX, subY);
+        cellWindows.add(playerIndex(currentPlayer), g, board.cellIndex(subX, subY));
+        emptyCells.erase(g, board.cellIndex(subX, subY));
+        key ^= keys->cell(g * n * n + board.cellIndex(subX, subY), playerIndex(currentPlayer));
+    }
+
+    void markGridWon(int mainX, int mainY) {
+        TTT_COUNT(GridsWon);
+        mainGridWinners[mainX * n + mainY] = currentPlayer;
+        gridBits.set(playerIndex(currentPlayer), 0, mainX * n + mainY);
+        gridLines.add(playerIndex(currentPlayer), 0, mainX, mainY);
+        gridWindows.add(playerIndex(currentPlayer), 0, mainX * n + mainY);
+        openGridSet.erase(0, mainX * n + mainY);
+        key ^= keys->winner(mainX * n + mainY, playerIndex(currentPlayer));
+    }
+
+    void removeStone(int mainX, int mainY, int subX, int subY) {
+        board.set(mainX, mainY, subX, subY, '.');
+        int g = board.gridIndex(mainX, mainY);
+        cellBits.clear(playerIndex(currentPlayer), g, board.cellIndex(subX, subY));
+        cellLines.remove(playerIndex(currentPlayer), g, subX, subY);
+        cellWindows.remove(playerIndex(currentPlayer), g, board.cellIndex(subX, subY));
+        emptyCells.restore(g, board.cellIndex(subX, subY));
+        key ^= keys->cell(g * n * n + board.cellIndex(subX, subY), playerIndex(currentPlayer));
+    }
+
+    void unmarkGridWon(int mainX, int mainY) {
+        mainGridWinners[mainX * n + mainY] = '.';
+        gridBits.clear(playerIndex(currentPlayer), 0, mainX * n + mainY);
+        gridLines.remove(playerIndex(currentPlayer), 0, mainX, mainY);
+        gridWindows.remove(playerIndex(currentPlayer), 0, mainX * n + mainY);
+        openGridSet.restore(0, mainX * n + mainY);
+        key ^= keys->winner(mainX * n + mainY, playerIndex(currentPlayer));
+    }
+
+    // Closes sub-grid g as drawn: no line of it can be completed by either
+    // player. The mark follows from the cells, so it does not enter the key.
+    void markGridDead(int g) {
+        mainGridWinners[g] = '-';
+        gridWindows.block(0, g);
+        openGridSet.erase(0, g);
+    }
+
+    void unmarkGridDead(int g) {
+        mainGridWinners[g] = '.';
+        gridWindows.unblock(0, g);
+        openGridSet.restore(0, g);
+    }
+
+    void togglePlayer() {
+        currentPlayer = (currentPlayer == 'X') ? 'O' : 'X';
+        key ^= keys->oToMove();
+    }
+
+    // Bytes of the block in use with `records` undo records; history is last.
+    size_t blockPrefix(int records) const {
+        return size_t(reinterpret_cast<const unsigned char*>(history + records) - arena.data());
+    }
+
+    // Did the stone just placed at (subX, subY) complete a line of its sub-grid?
+    bool checkWin(int mainX, int mainY, int subX, int subY) {
+        TTT_COUNT(WinChecks);
+        TTT_TIME(CheckWin);
+        if (cellRun < n) return runThrough(board.grid(board.gridIndex(mainX, mainY)), n, cellRun, subX, subY, currentPlayer);
+        if (winCheck == WinCheck::Counters) {
+            return cellLines.completes(playerIndex(currentPlayer), board.gridIndex(mainX, mainY), subX, subY);
+        }
+        if (winCheck == WinCheck::Bitboard) {
+            return kernels.bits(cellBits.grid(playerIndex(currentPlayer), board.gridIndex(mainX, mainY)), lineMasks);
+        }
+
+        return kernels.scan(board.grid(board.gridIndex(mainX, mainY)), n, currentPlayer);
+    }
+
+    // Did winning sub-grid (mainX, mainY) complete a line of the main grid?
+    bool checkMainGridWin(int mainX, int mainY) {
+        TTT_COUNT(MainGridChecks);
+        TTT_TIME(CheckMainGridWin);
+        if (gridRun < n) return runThrough(mainGridWinners, n, gridRun, mainX, mainY, currentPlayer);
+        if (winCheck == WinCheck::Counters) {
+            return gridLines.completes(playerIndex(currentPlayer), 0, mainX, mainY);
+        }
+        if (winCheck == WinCheck::Bitboard) {
+            return kernels.bits(gridBits.grid(playerIndex(currentPlayer), 0), lineMasks);
+        }
+
+        return kernels.scan(mainGridWinners, n, currentPlayer);
+    }
+};
+
+// A worker's own branch of a shared parent position, for what-if evaluation
+// across threads. The parent is read once, when the fork is made, so any
+// number of workers may fork from it as long as it does not change meanwhile.
+// The branch cannot undo past the fork point, so rewind() brings it back by
+// undoing its own moves, which rewrites only the sub-grids the branch touched.
+class PositionFork {
+public:
+    explicit PositionFork(const TicTacToe& parent) : game(parent), baseActive(parent.activeGrid()) { game.fixHistory(); }
+
+    TicTacToe& rewind() {
+        while (game.undoMove()) {}
+        game.setActiveGrid(baseActive);
+        return game;
+    }
+
+    TicTacToe& branch() { return game; }
+
+private:
+    TicTacToe game;
+    int baseActive;
+};
+
+// Fixed-size transposition table. Each slot is two 64-bit words written
+// independently, with the key stored XORed with the data, so a torn write
+// from a concurrent searcher reads back as a miss rather than bad data.
+class TranspositionTable {
+public:
+    enum Bound : uint8_t { None = 0, Upper = 1, Lower = 2, Exact = 3 };
+
+    struct Entry {
+        Move move;
+        int score;
+        int depth;
+        Bound bound;
+    };
+
+    explicit TranspositionTable(size_t megabytes) : generation(0) {
+        size_t count = 1;
+        while (count * 2 * sizeof(Slot) <= megabytes * 1024 * 1024) count *= 2;
+        slots = vector<Slot>(count);
+        mask = count - 1;
+    }
+
+    void newSearch() { generation = (generation + 1) & 63; }
+
+    bool probe(uint64_t key, Entry& entry) const {
+        const Slot& slot = slots[key & mask];
+        uint64_t data = slot.data.load(memory_order_relaxed);
+        if ((slot.key.load(memory_order_relaxed) ^ data) != key) return false;
+        entry.move = Move{int(data & 0xffff) - 1, int((data >> 16) & 0xffff)};
+        entry.score = int16_t(data >> 32);
+        entry.depth = int((data >> 48) & 0xff);
+        entry.bound = Bound((data >> 56) & 3);
+        return true;
+    }
+
+    // Replaces the slot unless it holds a deeper result for another position from this search.
+    void store(uint64_t key, Move move, int score, int depth, Bound bound) {
+        Slot& slot = slots[key & mask];
+        uint64_t old = slot.data.load(memory_order_relaxed);
+        bool sameKey = (slot.key.load(memory_order_relaxed) ^ old) == key;
+        if (!sameKey && int(old >> 58) == generation && int((old >> 48) & 0xff) > depth) return;
+        uint64_t data = uint64_t(uint16_t(move.grid + 1)) | uint64_t(uint16_t(move.cell)) << 16 |
+                        uint64_t(uint16_t(int16_t(score))) << 32 | uint64_t(uint8_t(depth)) << 48 |
+                        uint64_t(bound) << 56 | uint64_t(generation) << 58;
+        slot.key.store(key ^ data, memory_order_relaxed);
+        slot.data.store(data, memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        atomic<uint64_t> key{0};
+        atomic<uint64_t> data{0};
+    };
+
+    vector<Slot> slots;
+    size_t mask;
+    int generation;
+};
+
+// Positions whose best move is already known, looked up by canonical Zobrist
+// key before searching, so one entry covers all 8 symmetric images; moves are
+// stored in the canonical frame. The file is an open-addressing table that is
+// mmap'd read-only, so lookups need no locks and loading costs no parsing:
+//   header (32 bytes): "TTBK" u32 version u32 n u8 cellRun u8 gridRun u16 reserved
+//                      u64 slots u64 entries  (a run of 0 is a full line)
+//   slot (16 bytes):   u64 key (0 = empty) u16 grid u16 cell i16 score u8 depth u8 flags
+// A slot count that is a power of two and at most half full keeps probes short.
+class PositionBook {
+public:
+    static const uint32_t Version = 2;
+    static const size_t HeaderBytes = 32;
+
+    struct Entry {
+        Move move{-1, -1};
+        int score = 0;
+        int depth = 0;
+        bool solved = false;  // score is a forced win or loss, not an estimate
+    };
+
+    PositionBook() : base(nullptr), bytes(0), slots(0) {}
+    PositionBook(const PositionBook&) = delete;
+    PositionBook& operator=(const PositionBook&) = delete;
+
+    ~PositionBook() {
+        if (base) munmap(base, bytes);
+    }
+
+    // Maps the book at path; false if it is missing, malformed or for another n or rule.
+    bool open(const string& path, int n, WinRule rule = WinRule()) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        off_t size = lseek(fd, 0, SEEK_END);
+        void* mapped = size >= off_t(HeaderBytes) ? mmap(nullptr, size_t(size), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (mapped == MAP_FAILED) return false;
+
+        const unsigned char* header = static_cast<const unsigned char*>(mapped);
+        uint32_t fields[2];
+        uint64_t count, used;
+        memcpy(fields, header + 4, sizeof(fields));
+        memcpy(&count, header + 16, sizeof(count));
+        memcpy(&used, header + 24, sizeof(used));
+        if (memcmp(header, "TTBK", 4) != 0 || fields[0] != Version || fields[1] != uint32_t(n) ||
+            !rule.sameAs(WinRule{header[12], header[13]}, n) || count == 0 ||
+            (count & (count - 1)) != 0 || used > count / 2 || count != (uint64_t(size) - HeaderBytes) / 16 ||
+            HeaderBytes + count * 16 != uint64_t(size)) {
+            munmap(mapped, size_t(size));
+            return false;
+        }
+        if (base) munmap(base, bytes);
+        base = static_cast<unsigned char*>(mapped);
+        bytes = size_t(size);
+        slots = count;
+        return true;
+    }
+
+    bool ok() const { return base != nullptr; }
+
+    bool probe(uint64_t key, Entry& entry) const {
+        if (!base || key == 0) return false;
+        // open() rejects books over half full, but a damaged one may have no empty slot.
+        for (uint64_t step = 0, i = key & (slots - 1); step < slots; ++step, i = (i + 1) & (slots - 1)) {
+            const unsigned char* slot = base + HeaderBytes + i * 16;
+            uint64_t stored;
+            memcpy(&stored, slot, sizeof(stored));
+            if (stored == 0) return false;
+            if (stored != key) continue;
+            uint16_t grid, cell;
+            int16_t score;
+            memcpy(&grid, slot + 8, 2);
+            memcpy(&cell, slot + 10, 2);
+            memcpy(&score, slot + 12, 2);
+            entry.move = Move{grid, cell};
+            entry.score = score;
+            entry.depth = slot[14];
+            entry.solved = (slot[15] & 1) != 0;
+            return true;
+        }
+        return false;
+    }
+
+    // Lays out `entries` as a book file for an n board played under `rule`.
+    static bool write(const string& path, int n, WinRule rule, const vector<pair<uint64_t, Entry> >& entries) {
+        uint64_t count = 16;
+        while (count < 2 * entries.size()) count *= 2;
+        vector<unsigned char> table(HeaderBytes + count * 16, 0);
+        memcpy(&table[0], "TTBK", 4);
+        uint32_t fields[2] = {Version, uint32_t(n)};
+        memcpy(&table[4], fields, sizeof(fields));
+        table[12] = uint8_t(rule.resolved(n).cellRun);
+        table[13] = uint8_t(rule.resolved(n).gridRun);
+        memcpy(&table[16], &count, sizeof(count));
+        uint64_t used = 0;
+        for (const auto& kv : entries) {
+            if (kv.first == 0) continue;
+            uint64_t i = kv.first & (count - 1);
+            uint64_t stored;
+            for (;; i = (i + 1) & (count - 1)) {
+                memcpy(&stored, &table[HeaderBytes + i * 16], sizeof(stored));
+                if (stored == 0 || stored == kv.first) break;
+            }
+            unsigned char* slot = &table[HeaderBytes + i * 16];
+            if (stored == 0) ++used;
+            uint16_t grid = uint16_t(kv.second.move.grid), cell = uint16_t(kv.second.move.cell);
+            int16_t score = int16_t(kv.second.score);
+            memcpy(slot, &kv.first, 8);
+            memcpy(slot + 8, &grid, 2);
+            memcpy(slot + 10, &cell, 2);
+            memcpy(slot + 12, &score, 2);
+            slot[14] = uint8_t(min(kv.second.depth, 255));
+            slot[15] = kv.second.solved ? 1 : 0;
+        }
+        memcpy(&table[24], &used, sizeof(used));
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        bool written = fwrite(table.data(), 1, table.size(), file) == table.size();
+        return fclose(file) == 0 && written;
+    }
+
+private:
+    unsigned char* base;
+    size_t bytes;
+    uint64_t slots;
+};
+
+// Stop conditions for one search; zero means "no limit".
+struct SearchLimits {
+    int maxDepth = 32;
+    long long maxNodes = 0;
+    int maxMillis = 0;
+};
+
+struct SearchResult {
+    Move best{-1, -1};
+    int score = 0;
+    int depth = 0;
+    long long nodes = 0;
+};
+
+// Iterative-deepening negamax with alpha-beta pruning over the headless
+// engine. Only the root is searched in the real active grid: the grid the
+// opponent gets next is drawn at random, so deeper plies are searched as if the
+// mover could pick any open grid, which bounds the value of the random draw.
+class AIPlayer {
+public:
+    static const int WinScore = 30000;
+
+    AIPlayer(int n, size_t ttMegabytes = 16)
+        : n(n), table(ttMegabytes), history(n * n * n * n, 0),
+          scratch(4 * (BumpArena::footprint<Move>(n * n * n * n) + BumpArena::footprint<Scored>(n * n * n * n))) {}
+
+    // Positions `book` has solved, or searched at least as deep as the limits
+    // allow, are answered from it without searching; other book moves are
+    // searched first.
+    void useBook(const PositionBook* positions) { book = positions; }
+
+    SearchResult search(TicTacToe& game, const SearchLimits& limits) {
+        TTT_TIME(Search);
+        SearchResult result;
+        const Symmetries& symmetry = game.symmetries();
+        int frame = game.canonicalTransform();
+        uint64_t key = game.symmetricHash(frame);
+        PositionBook::Entry known;
+        bool inBook = book && book->probe(key, known) && game.isLegal(symmetry.apply(symmetry.inverse(frame), known.move));
+        if (inBook && (known.solved || known.depth >= limits.maxDepth)) {
+            result.best = symmetry.apply(symmetry.inverse(frame), known.move);
+            result.score = known.score;
+            result.depth = known.depth;
+            return result;
+        }
+
+        scratch.reset();
+        plyMoves.assign(limits.maxDepth + 1, nullptr);
+        plyOrder.assign(limits.maxDepth + 1, nullptr);
+        plyCapacity = n * n * n * n - game.moveCount();
+        Move* rootMoves = movesAt(0);
+        if (game.legalMoves(rootMoves) == 0) return result;
+        result.best = rootMoves[0];
+
+        nodes = 0;
+        stopped = false;
+        nodeLimit = limits.maxNodes;
+        useClock = limits.maxMillis > 0;
+        deadline = chrono::steady_clock::now() + chrono::milliseconds(limits.maxMillis);
+        table.newSearch();
+        fill(history.begin(), history.end(), 0);
+        if (inBook) {
+            // A depth-0 entry only makes the book move the root's hash move.
+            table.store(key, known.move, 0, 0, TranspositionTable::None);
+            result.best = symmetry.apply(symmetry.inverse(frame), known.move);
+        }
+
+        for (int depth = 1; depth <= limits.maxDepth; ++depth) {
+            int score = negamax(game, depth, -WinScore - 1, WinScore + 1, 0);
+            if (stopped) break;
+            TranspositionTable::Entry entry;
+            if (table.probe(key, entry) && entry.move.grid >= 0) result.best = symmetry.apply(symmetry.inverse(frame), entry.move);
+            result.score = score;
+            result.depth = depth;
+            if (score >= WinScore - 64 || score <= -WinScore + 64) break;  // forced result found
+        }
+        result.nodes = nodes;
+        return result;
+    }
+
+private:
+    int n;
+    TranspositionTable table;
+    // A move with its ordering score; ties keep generation order.
+    struct Scored {
+        int score;
+        int index;
+        Move move;
+    };
+
+    vector<int> history;                 // history heuristic, indexed by grid * n * n + cell
+    BumpArena scratch;                   // per-ply buffers, released in bulk by each search
+    vector<Move*> plyMoves;              // allocated from scratch the first time a ply is reached
+    vector<Scored*> plyOrder;
+    int plyCapacity = 0;                 // moves any position of the current search can have
+    const PositionBook* book = nullptr;
+    long long nodes = 0;
+    long long nodeLimit = 0;
+    bool useClock = false;
+    bool stopped = false;
+    chrono::steady_clock::time_point deadline;
+
+    Move* movesAt(int ply) {
+        if (!plyMoves[ply]) {
+            plyMoves[ply] = scratch.allocate<Move>(plyCapacity);
+            plyOrder[ply] = scratch.allocate<Scored>(plyCapacity);
+        }
+        return plyMoves[ply];
+    }
+
+    void checkLimits() {
+        if (nodeLimit > 0 && nodes >= nodeLimit) stopped = true;
+        if (useClock && chrono::steady_clock::now() >= deadline) stopped = true;
+    }
+
+    // Static score from the side to move's point of view: open lines weighted by
+    // how many of their cells (or sub-grids, in the main grid) each player holds.
+    // Under a shorter run the lines are its k-windows, which are what can be won.
+    int evaluate(const TicTacToe& game) const {
+        WinRule rule = game.rule();
+        int score = 0;
+        for (int g = 0; g < n * n; ++g) {
+            if (!game.gridOpen(g)) continue;
+            score += rule.cellRun < n ? openLineScore(game.subGridWindows(), g) : openLineScore(game.subGridLines(), g);
+        }
+        score += 16 * n * (rule.gridRun < n ? openLineScore(game.mainGridWindows(), 0) : openLineScore(game.mainGridLines(), 0));
+        score = max(-WinScore / 2, min(WinScore / 2, score));
+        return game.toMove() == 'X' ? score : -score;
+    }
+
+    // Sum of x^2 over lines of grid g only X holds cells in, less o^2 over O's.
+    static int openLineScore(const LineCounters& lines, int g) {
+        int score = 0;
+        for (int l = 0; l < lines.lineCount(); ++l) {
+            int x = lines.count(0, g, l), o = lines.count(1, g, l);
+            if (o == 0) score += x * x;
+            else if (x == 0) score -= o * o;
+        }
+        return score;
+    }
+
+    static int openLineScore(const LiveWindows& windows, int g) {
+        int score = 0;
+        for (int w = 0; w < windows.windowsPerGrid(); ++w) {
+            int x = windows.count(0, g, w), o = windows.count(1, g, w);
+            if (o == 0) score += x * x;
+            else if (x == 0) score -= o * o;
+        }
+        return score;
+    }
+
+    // Orders moves: hash move, then sub-grid wins, then blocks, then history.
+    void orderMoves(const TicTacToe& game, Move* moves, int count, Move hashMove, int ply) {
+        Scored* order = plyOrder[ply];
+        char me = game.toMove();
+        char them = me == 'X' ? 'O' : 'X';
+        for (int i = 0; i < count; ++i) {
+            Move m = moves[i];
+            int score = history[m.grid * n * n + m.cell];
+            if (m.grid == hashMove.grid && m.cell == hashMove.cell) score = 1 << 30;
+            else if (game.completesLine(m, me)) score += 1 << 24;
+            else if (game.completesLine(m, them)) score += 1 << 23;
+            order[i] = Scored{score, i, m};
+        }
+        sort(order, order + count, [](const Scored& a, const Scored& b) {
+            return a.score != b.score ? a.score > b.score : a.index < b.index;
+        });
+        for (int i = 0; i < count; ++i) moves[i] = order[i].move;
+    }
+
+    int negamax(TicTacToe& game, int depth, int alpha, int beta, int ply) {
+        if ((++nodes & 1023) == 0) checkLimits();
+        if (stopped) return 0;
+
+        if (game.status() == GameStatus::Draw) return 0;
+        if (game.status() != GameStatus::InProgress) return -(WinScore - ply);  // the last mover won
+        if (depth == 0) return evaluate(game);
+
+        // The table is keyed by the canonical image; its moves are in that frame.
+        const Symmetries& symmetry = game.symmetries();
+        int frame = game.canonicalTransform();
+        uint64_t key = game.symmetricHash(frame);
+        int originalAlpha = alpha;
+        Move hashMove{-1, -1};
+        TranspositionTable::Entry entry;
+        if (table.probe(key, entry)) {
+            if (entry.move.grid >= 0) hashMove = symmetry.apply(symmetry.inverse(frame), entry.move);
+            if (entry.depth >= depth) {
+                int score = fromTable(entry.score, ply);
+                if (entry.bound == TranspositionTable::Exact) return score;
+                if (entry.bound == TranspositionTable::Lower) alpha = max(alpha, score);
+                if (entry.bound == TranspositionTable::Upper) beta = min(beta, score);
+                if (alpha >= beta) return score;
+            }
+        }
+
+        Move* moves = movesAt(ply);
+        int count = game.legalMoves(moves);
+        orderMoves(game, moves, count, hashMove, ply);
+
+        int best = -WinScore - 1;
+        Move bestMove = moves[0];
+        for (int i = 0; i < count; ++i) {
+            Move m = moves[i];
+            game.applyMove(m);
+            int score = -negamax(game, depth - 1, -beta, -alpha, ply + 1);
+            game.undoMove();
+            if (stopped) return 0;
+
+            if (score > best) {
+                best = score;
+                bestMove = m;
+            }
+            if (score > alpha) alpha = score;
+            if (alpha >= beta) {
+                history[m.grid * n * n + m.cell] += depth * depth;
+                break;
+            }
+        }
+
+        TranspositionTable::Bound bound = best <= originalAlpha ? TranspositionTable::Upper
+                                        : best >= beta          ? TranspositionTable::Lower
+                                                                : TranspositionTable::Exact;
+        table.store(key, symmetry.apply(frame, bestMove), toTable(best, ply), depth, bound);
+        return best;
+    }
+
+    // Win scores are stored relative to the node so they stay valid at any ply.
+    static int toTable(int score, int ply) {
+        if (score >= WinScore - 1024) return score + ply;
+        if (score <= -WinScore + 1024) return score - ply;
+        return score;
+    }
+    static int fromTable(int score, int ply) {
+        if (score >= WinScore - 1024) return score - ply;
+        if (score <= -WinScore + 1024) return score + ply;
+        return score;
+    }
+};
+
+// Stop conditions and parallelism for one MCTS search; zero means "no limit".
+struct MctsLimits {
+    int maxMillis = 1000;
+    long long maxPlayouts = 0;
+    int threads = 1;  // threads sharing each tree (tree parallelism)
+    int trees = 1;    // independent trees merged at the root (root parallelism)
+};
+
+struct MctsResult {
+    Move best{-1, -1};
+    long long playouts = 0;
+    double seconds = 0;
+};
+
+// Monte Carlo tree search with UCT selection. Threads descend a shared tree,
+// marking their path with a virtual loss so that concurrent descents spread out;
+// visit and value counters are atomics. Below the root the next sub-grid is
+// random, so each node expands every open-grid move and a descent first draws
+// the grid, then selects among that grid's children (kept contiguous).
+class MctsPlayer {
+public:
+    explicit MctsPlayer(size_t nodeCapacity = size_t(1) << 20) : capacity(nodeCapacity) {}
+
+    MctsResult search(const TicTacToe& game, const MctsLimits& limits, uint64_t seed = 1) {
+        TTT_TIME(Search);
+        MctsResult result;
+        int treeCount = max(1, limits.trees);
+        int threadCount = max(treeCount, limits.threads * treeCount);
+
+        while (int(trees.size()) < treeCount) trees.emplace_back(new Tree);
+        trees.resize(treeCount);
+        for (auto& tree : trees) tree->reset(capacity / treeCount, game);
+        if (trees[0]->childCount(0) == 0) return result;
+
+        stop = false;
+        playouts = 0;
+        playoutLimit = limits.maxPlayouts;
+        auto start = chrono::steady_clock::now();
+        deadline = start + chrono::milliseconds(limits.maxMillis);
+        useClock = limits.maxMillis > 0;
+
+        vector<thread> workers;
+        for (int t = 1; t < threadCount; ++t) {
+            workers.emplace_back(&MctsPlayer::work, this, ref(*trees[t % treeCount]), cref(game), seed + t);
+        }
+        work(*trees[0], game, seed);
+        for (thread& w : workers) w.join();
+
+        result.playouts = playouts;
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        // Root children are generated from the same position, so they line up across trees.
+        const Tree& first = *trees[0];
+        long long bestVisits = -1;
+        for (uint32_t i = 0; i < first.childCount(0); ++i) {
+            long long visits = 0;
+            for (const auto& tree : trees) visits += tree->node(tree->firstChild(0) + i).visits.load(memory_order_relaxed);
+            if (visits > bestVisits) {
+                bestVisits = visits;
+                result.best = first.node(first.firstChild(0) + i).move;
+            }
+        }
+        return result;
+    }
+
+private:
+    struct Node {
+        Move move{-1, -1};
+        atomic<int32_t> visits{0};
+        atomic<int32_t> virtualLoss{0};
+        atomic<int64_t> value{0};         // 2 per win, 1 per draw, for the player who made `move`
+        atomic<uint32_t> first{0};        // index of the first child in the pool
+        atomic<uint32_t> count{0};
+        atomic<uint8_t> state{Unexpanded};
+
+        enum : uint8_t { Unexpanded, Expanding, Expanded };
+    };
+
+    // Bump-allocated node pool for one tree; released in bulk by reset().
+    class Tree {
+    public:
+        void reset(size_t nodeCapacity, const TicTacToe& game) {
+            if (nodeCapacity != capacity) {
+                nodes.reset(new Node[nodeCapacity]);
+                capacity = nodeCapacity;
+            }
+            used = 1;
+            init(0, Move{-1, -1});
+            vector<Move> moves;
+            game.legalMoves(moves);
+            expand(0, moves);
+        }
+
+        const Node& node(uint32_t i) const { return nodes[i]; }
+        Node& node(uint32_t i) { return nodes[i]; }
+        uint32_t firstChild(uint32_t i) const { return nodes[i].first.load(memory_order_acquire); }
+        uint32_t childCount(uint32_t i) const { return nodes[i].count.load(memory_order_acquire); }
+
+        // Gives node i one child per move; false if the pool is exhausted.
+        bool expand(uint32_t i, const vector<Move>& moves) {
+            size_t begin = used.fetch_add(moves.size(), memory_order_relaxed);
+            if (begin + moves.size() > capacity) {
+                nodes[i].state.store(Node::Unexpanded, memory_order_release);
+                return false;
+            }
+            for (size_t k = 0; k < moves.size(); ++k) init(uint32_t(begin + k), moves[k]);
+            nodes[i].first.store(uint32_t(begin), memory_order_relaxed);
+            nodes[i].count.store(uint32_t(moves.size()), memory_order_release);
+            nodes[i].state.store(Node::Expanded, memory_order_release);
+            return true;
+        }
+
+    private:
+        unique_ptr<Node[]> nodes;
+        size_t capacity = 0;
+        atomic<size_t> used{0};
+
+        void init(uint32_t i, Move m) {
+            Node& nd = nodes[i];
+            nd.move = m;
+            nd.visits.store(0, memory_order_relaxed);
+            nd.virtualLoss.store(0, memory_order_relaxed);
+            nd.value.store(0, memory_order_relaxed);
+            nd.first.store(0, memory_order_relaxed);
+            nd.count.store(0, memory_order_relaxed);
+            nd.state.store(Node::Unexpanded, memory_order_relaxed);
+        }
+    };
+
+    size_t capacity;
+    vector<unique_ptr<Tree> > trees;
+    atomic<bool> stop{false};
+    atomic<long long> playouts{0};
+    long long playoutLimit = 0;
+    bool useClock = false;
+    chrono::steady_clock::time_point deadline;
+
+    // UCT over children [begin, end); in-flight descents count as losses.
+    static uint32_t select(const Tree& tree, uint32_t begin, uint32_t end, int parentVisits) {
+        double logParent = log(double(parentVisits) + 1);
+        uint32_t best = begin;
+        double bestScore = -1;
+        for (uint32_t i = begin; i < end; ++i) {
+            const Node& child = tree.node(i);
+            int visits = child.visits.load(memory_order_relaxed) + child.virtualLoss.load(memory_order_relaxed);
+            if (visits == 0) return i;
+            double q = double(child.value.load(memory_order_relaxed)) / (2.0 * visits);
+            double score = q + 1.0 * sqrt(logParent / visits);
+            if (score > bestScore) {
+                bestScore = score;
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    void work(Tree& tree, const TicTacToe& root, uint64_t seed) {
+        TicTacToe game = root;
+        Xoshiro256 rng(seed * 0x9e3779b97f4a7c15ULL);
+        vector<pair<uint32_t, int> > path;  // node and the index of the player who moved into it
+        vector<Move> moves;
+
+        while (!stop.load(memory_order_relaxed)) {
+            path.clear();
+            uint32_t current = 0;
+            int applied = 0;
+
+            while (game.status() == GameStatus::InProgress) {
+                Node& nd = tree.node(current);
+                if (nd.state.load(memory_order_acquire) != Node::Expanded) {
+                    uint8_t expected = Node::Unexpanded;
+                    if (nd.visits.load(memory_order_relaxed) == 0 ||
+                        !nd.state.compare_exchange_strong(expected, Node::Expanding, memory_order_acq_rel)) break;
+                    game.legalMoves(moves);
+                    if (!tree.expand(current, moves)) break;
+                }
+
+                uint32_t begin = tree.firstChild(current);
+                uint32_t end = begin + tree.childCount(current);
+                if (game.activeGrid() < 0) {
+                    int g = game.randomOpenGrid(rng);
+                    auto lower = [&](uint32_t lo, uint32_t hi, int grid) {
+                        while (lo < hi) {
+                            uint32_t mid = (lo + hi) / 2;
+                            if (tree.node(mid).move.grid < grid) lo = mid + 1;
+                            else hi = mid;
+                        }
+                        return lo;
+                    };
+                    uint32_t from = lower(begin, end, g);
+                    end = lower(from, end, g + 1);
+                    begin = from;
+                }
+                uint32_t child = select(tree, begin, end, nd.visits.load(memory_order_relaxed));
+                tree.node(child).virtualLoss.fetch_add(1, memory_order_relaxed);
+                path.emplace_back(child, TicTacToe::playerIndex(game.toMove()));
+                game.applyMove(tree.node(child).move);
+                ++applied;
+                current = child;
+            }
+
+            int played = 0;
+            while (game.status() == GameStatus::InProgress) {
+                game.applyMove(game.randomMove(rng));
+                ++played;
+            }
+
+            GameStatus outcome = game.status();
+            for (const auto& step : path) {
+                Node& nd = tree.node(step.first);
+                int reward = outcome == GameStatus::Draw ? 1 : (int(outcome == GameStatus::OWins) == step.second) * 2;
+                nd.value.fetch_add(reward, memory_order_relaxed);
+                nd.visits.fetch_add(1, memory_order_relaxed);
+                nd.virtualLoss.fetch_sub(1, memory_order_relaxed);
+            }
+            tree.node(0).visits.fetch_add(1, memory_order_relaxed);
+
+            for (int i = 0; i < played + applied; ++i) game.undoMove();
+
+            long long done = playouts.fetch_add(1, memory_order_relaxed) + 1;
+            if (playoutLimit > 0 && done >= playoutLimit) stop = true;
+            if (useClock && (done & 255) == 0 && chrono::steady_clock::now() >= deadline) stop = true;
+        }
+    }
+};
+
+// Renders the board the way displayBoard() used to, but builds the whole frame
+// in one preallocated buffer and emits it with a single write(). In ANSI diff
+// mode the first frame is drawn from the top of the screen and later frames only
+// reposition the cursor over cells whose text changed since the previous frame.
+class BoardRenderer {
+public:
+    explicit BoardRenderer(int n, bool ansiDiff = false)
+        : n(n), ansiDiff(ansiDiff), drawn(false), lastActive(-1), previous(n * n * n * n, '.') {
+        int width = n * (3 * n + 3);
+        buffer.reserve(size_t(n * n + n + 8) * width + size_t(n) * n * n * n * 12 + 64);
+    }
+
+    // Builds the frame for the given active grid into frame().
+    void render(const TicTacToe& game, int activeMainX, int activeMainY) {
+        TTT_TIME(Render);
+        buffer.clear();
+        int active = activeMainX * n + activeMainY;
+        if (ansiDiff && drawn) renderDiff(game, active, activeMainX, activeMainY);
+        else renderFull(game, active, activeMainX, activeMainY);
+        lastActive = active;
+        drawn = true;
+    }
+
+    const string& frame() const { return buffer; }
+
+    void draw(const TicTacToe& game, int activeMainX, int activeMainY) {
+        render(game, activeMainX, activeMainY);
+        emit();
+    }
+
+    // Writes the frame to stdout in one call after anything cout still holds.
+    void emit() const {
+        cout.flush();
+        const char* data = buffer.data();
+        size_t left = buffer.size();
+        while (left > 0) {
+            ssize_t written = ::write(STDOUT_FILENO, data, left);
+            if (written <= 0) break;
+            data += written;
+            left -= size_t(written);
+        }
+    }
+
+private:
+    int n;
+    bool ansiDiff;
+    bool drawn;
+    int lastActive;
+    vector<char> previous;  // cell contents as of the last frame
+    string buffer;
+
+    void appendNumber(int value) {
+        char digits[12];
+        int len = 0;
+        do {
+            digits[len++] = char('0' + value % 10);
+            value /= 10;
+        } while (value > 0);
+        while (len > 0) buffer.push_back(digits[--len]);
+    }
+
+    void appendTitle(int activeMainX, int activeMainY) {
+        buffer.append("Full Board (Active grid: ");
+        appendNumber(activeMainX + 1);
+        buffer.push_back(',');
+        appendNumber(activeMainY + 1);
+        buffer.push_back(')');
+    }
+
+    void appendCell(char value, bool highlighted) {
+        buffer.push_back(highlighted ? '[' : ' ');
+        buffer.push_back(value);
+        buffer.push_back(highlighted ? ']' : ' ');
+    }
+
+    void moveCursor(int row, int col) {
+        buffer.append("\x1b[");
+        appendNumber(row);
+        buffer.push_back(';');
+        appendNumber(col);
+        buffer.push_back('H');
+    }
+
+    // Screen row just below the board in diff mode (rows and columns are 1-based,
+    // title on row 1, board from row 3).
+    int bottomRow() const { return 3 + n * n + (n - 1); }
+
+    void renderFull(const TicTacToe& game, int active, int activeMainX, int activeMainY) {
+        const FlatBoard& board = game.cells();
+        if (ansiDiff) buffer.append("\x1b[H\x1b[2J");
+        else buffer.push_back('\n');
+        appendTitle(activeMainX, activeMainY);
+        buffer.append("\n\n");
+
+        // For each row of sub-grids
+        for (int mainRow = 0; mainRow < n; mainRow++) {
+            // For each row within the sub-grids
+            for (int subRow = 0; subRow < n; subRow++) {
+                for (int mainCol = 0; mainCol < n; mainCol++) {
+                    int g = board.gridIndex(mainRow, mainCol);
+                    const char* row = board.grid(g) + subRow * n;
+                    for (int subCol = 0; subCol < n; subCol++) appendCell(row[subCol], g == active);
+                    if (mainCol < n - 1) buffer.append(" | ");
+                }
+                buffer.push_back('\n');
+            }
+            // Horizontal separator between rows of sub-grids
+            if (mainRow < n - 1) {
+                buffer.append(size_t(n * (n * 3 + 2) - 1), '-');
+                buffer.push_back('\n');
+            }
+        }
+        if (ansiDiff) buffer.append("\x1b[J");
+        else buffer.push_back('\n');
+        copy(board.grid(0), board.grid(0) + n * n * n * n, previous.begin());
+    }
+
+    void renderDiff(const TicTacToe& game, int active, int activeMainX, int activeMainY) {
+        const FlatBoard& board = game.cells();
+        buffer.append("\x1b[1;1H");
+        appendTitle(activeMainX, activeMainY);
+        buffer.append("\x1b[K");
+
+        for (int g = 0; g < n * n; ++g) {
+            bool highlighted = g == active;
+            bool highlightChanged = highlighted != (g == lastActive);
+            const char* cells = board.grid(g);
+            char* before = &previous[g * n * n];
+            int mainRow = g / n, mainCol = g % n;
+            for (int c = 0; c < n * n; ++c) {
+                if (!highlightChanged && cells[c] == before[c]) continue;
+                int subRow = c / n, subCol = c % n;
+                moveCursor(3 + mainRow * (n + 1) + subRow, 1 + mainCol * (3 * n + 3) + subCol * 3);
+                appendCell(cells[c], highlighted);
+                before[c] = cells[c];
+            }
+        }
+        moveCursor(bottomRow() + 1, 1);
+        buffer.append("\x1b[J");
+    }
+};
+
+// Splits one line of input into space-separated tokens without copying or
+// allocating; numbers are read with from_chars.
+class LineScanner {
+public:
+    LineScanner(const char* begin, const char* end) : pos(begin), end(end) {}
+
+    bool atEnd() {
+        skipSpaces();
+        return pos == end;
+    }
+
+    // Next token as [word, word + length), or false at the end of the line.
+    bool word(const char*& word, size_t& length) {
+        skipSpaces();
+        if (pos == end) return false;
+        word = pos;
+        while (pos != end && !isSpace(*pos)) ++pos;
+        length = size_t(pos - word);
+        return true;
+    }
+
+    // Next token as an integer; false (consuming nothing) if it is not one.
+    template <class T>
+    bool number(T& value) {
+        skipSpaces();
+        from_chars_result parsed = from_chars(pos, end, value);
+        if (parsed.ec != errc() || (parsed.ptr != end && !isSpace(*parsed.ptr))) return false;
+        pos = parsed.ptr;
+        return true;
+    }
+
+    static bool equals(const char* word, size_t length, const char* text) {
+        return strlen(text) == length && memcmp(word, text, length) == 0;
+    }
+
+private:
+    const char* pos;
+    const char* end;
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    void skipSpaces() {
+        while (pos != end && isSpace(*pos)) ++pos;
+    }
+};
+
+// Token stream of moves for play(): "r c" pairs and "Quit", any number per
+// line. Lines are read into one reused buffer, or in bulk mode the whole
+// stream is read up front, as when a scripted game is piped in.
+class MoveReader {
+public:
+    enum Kind { Pair, Quit, Bad, End };
+
+    MoveReader(istream& in, bool bulk) : in(in), bulk(bulk), next(0), scan(nullptr, nullptr) {
+        if (bulk) buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+
+    // Reads the next pair into (r, c). A token that is not a number is Bad
+    // and skipped; a bad second number also drops the rest of its line.
+    Kind read(int& r, int& c) {
+        const char* word;
+        size_t length;
+        if (!token(word, length)) return End;
+        if (LineScanner::equals(word, length, "Quit") || LineScanner::equals(word, length, "quit")) return Quit;
+        if (!parse(word, length, r)) return Bad;
+        if (!token(word, length)) return End;
+        if (!parse(word, length, c)) {
+            scan = LineScanner(nullptr, nullptr);
+            return Bad;
+        }
+        return Pair;
+    }
+
+private:
+    istream& in;
+    bool bulk;
+    string buffer;
+    size_t next;  // start of the first unread line in buffer
+    LineScanner scan;
+
+    bool token(const char*& word, size_t& length) {
+        while (!scan.word(word, length)) {
+            if (!nextLine()) return false;
+        }
+        return true;
+    }
+
+    bool nextLine() {
+        if (next >= buffer.size()) {
+            if (bulk || !getline(in, buffer)) return false;
+            next = 0;
+        }
+        const char* begin = buffer.data() + next;
+        const char* end = buffer.data() + buffer.size();
+        const char* eol = static_cast<const char*>(memchr(begin, '\n', size_t(end - begin)));
+        if (!eol) eol = end;
+        scan = LineScanner(begin, eol);
+        next = size_t(eol - buffer.data()) + 1;
+        return true;
+    }
+
+    static bool parse(const char* word, size_t length, int& value) {
+        from_chars_result parsed = from_chars(word, word + length, value);
+        return parsed.ec == errc() && parsed.ptr == word + length;
+    }
+};
+
+// Settings for the interactive game.
+struct PlayOptions {
+    char aiSide = 0;             // 'X' or 'O' to let the AI play that side
+    AIPlayer* ai = nullptr;      // alpha-beta player, used unless mcts is set
+    MctsPlayer* mcts = nullptr;  // MCTS player
+    SearchLimits limits;
+    MctsLimits mctsLimits;
+    bool ansiDiff = false;       // redraw only changed cells between frames
+    bool bulkInput = false;      // read all of stdin before the first move
+};
+
+void TicTacToe::play() {
+    play(PlayOptions());
+}
+
+void TicTacToe::play(const PlayOptions& options) {
+    MoveReader input(cin, options.bulkInput);
+    BoardRenderer renderer(n, options.ansiDiff);
+    
+    while (status() == GameStatus::InProgress) {
+        drawActiveGrid();
+        int mainX = activeGrid() / n, mainY = activeGrid() % n;
+
+        // In diff mode the title line already names the active grid.
+        if (!options.ansiDiff) cout << "\nCurrent grid: (" << mainX + 1 << ", " << mainY + 1 << ")\n";
+        renderer.draw(*this, mainX, mainY);
+
+        Move move;
+        if (currentPlayer == options.aiSide) {
+            if (options.mcts) {
+                MctsResult found = options.mcts->search(*this, options.mctsLimits, rng.next());
+                move = found.best;
+                cout << "Player " << currentPlayer << " (AI) plays " << move.cell / n + 1 << " " << move.cell % n + 1
+                     << " (" << found.playouts << " playouts)\n";
+            } else {
+                SearchResult found = options.ai->search(*this, options.limits);
+                move = found.best;
+                cout << "Player " << currentPlayer << " (AI) plays " << move.cell / n + 1 << " " << move.cell % n + 1
+                     << " (depth " << found.depth << ", " << found.nodes << " nodes)\n";
+            }
+        } else {
+            cout << "Player " << currentPlayer << ", enter your move (row and column 1 to " << n << ", or 'Quit' to end): ";
+            int subX, subY;
+            MoveReader::Kind kind = input.read(subX, subY);
+            if (kind == MoveReader::End) return;
+            if (kind == MoveReader::Quit) {
+                cout << "\nGame ended by player. Thanks for playing!\n";
+                return;
+            }
+            if (kind == MoveReader::Bad) {
+                cout << "Invalid input. Please enter two numbers or 'Quit'.\n";
+                continue;
+            }
+
+            if (!isValidMove(mainX, mainY, subX - 1, subY - 1)) {
+                TTT_COUNT(InvalidMoves);
+                cout << "Invalid move. Try again.\n";
+                continue;
+            }
+            move = Move{mainX * n + mainY, (subX - 1) * n + (subY - 1)};
+        }
+
+        char player = currentPlayer;
+        MoveResult result = applyMove(move);
+        if (result == MoveResult::GridWon || result == MoveResult::GameWon) {
+            renderer.draw(*this, mainX, mainY);
+            cout << "Player " << player << " wins grid (" << mainX + 1 << "," << mainY + 1 << ")!\n";
+        }
+        if (result == MoveResult::GameWon) {
+            renderer.draw(*this, mainX, mainY);
+            cout << "Player " << player << " wins the entire game!\n";
+            return;  // End the game only on main grid win
+        }
+    }
+
+    if (status() == GameStatus::Draw) {
+        cout << "\nNeither player can complete a line of the main grid. The game is a draw!\n";
+    }
+}
+
+// Command-line options of the form key=value, e.g. "ai=O ms=200".
+class Options {
+public:
+    Options(int argc, char** argv) {
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            size_t eq = arg.find('=');
+            if (eq == string::npos) values.emplace_back(arg, "");
+            else values.emplace_back(arg.substr(0, eq), arg.substr(eq + 1));
+        }
+    }
+
+    bool has(const string& key) const {
+        for (const auto& kv : values) if (kv.first == key) return true;
+        return false;
+    }
+
+    string get(const string& key, const string& fallback = "") const {
+        for (const auto& kv : values) if (kv.first == key) return kv.second;
+        return fallback;
+    }
+
+    long long number(const string& key, long long fallback) const {
+        string value = get(key);
+        return value.empty() ? fallback : atoll(value.c_str());
+    }
+
+private:
+    vector<pair<string, string> > values;
+};
+
+// k=K wins a sub-grid with K in a row and the game with K won sub-grids in a
+// row; grid_k=K overrides the main-grid run. Both default to a full line.
+WinRule winRule(const Options& args) {
+    WinRule rule;
+    rule.cellRun = int(args.number("k", 0));
+    rule.gridRun = int(args.number("grid_k", rule.cellRun));
+    return rule;
+}
+
+// False, after saying why, if n= is outside 4..MaxSize or threads= is below 1;
+// every mode that reads them checks here first.
+bool validSizeAndThreads(const Options& args) {
+    long long n = args.number("n", 4), threads = args.number("threads", 1);
+    if (n < 4 || n > TicTacToe::MaxSize) {
+        cout << "n must be from 4 to " << TicTacToe::MaxSize << ".\n";
+        return false;
+    }
+    if (threads < 1) {
+        cout << "threads must be at least 1.\n";
+        return false;
+    }
+    return true;
+}
+
+// Runs MCTS from a fresh board at 1, 2, 4, ... threads and prints playouts/sec
+// for each, to show how tree parallelism scales.
+int runMctsScaling(const Options& args) {
+    if (!validSizeAndThreads(args)) return 1;
+    int n = int(args.number("n", 6));
+    int maxThreads = int(args.number("threads", max(1u, thread::hardware_concurrency())));
+    MctsLimits limits;
+    limits.maxMillis = int(args.number("ms", 1000));
+    limits.trees = int(args.number("trees", 1));
+
+    TicTacToe game(n, WinCheck::Counters, 1, winRule(args));
+    game.setActiveGrid(0);
+    MctsPlayer mcts(size_t(args.number("nodes", 1 << 22)));
+
+    double base = 0;
+    for (int threads = 1;; threads *= 2) {
+        threads = min(threads, maxThreads);
+        limits.threads = threads;
+        MctsResult result = mcts.search(game, limits);
+        double rate = result.playouts / result.seconds;
+        if (threads == 1) base = rate;
+        cout << "threads=" << threads * limits.trees << " playouts=" << result.playouts
+             << " playouts_per_sec=" << long(rate) << " speedup=" << rate / base << "\n";
+        if (threads == maxThreads) break;
+    }
+    return 0;
+}
+
+// Version of the engine rules written into every game record.
+const uint16_t EngineVersion = 1;
+
+// One archived game. On disk (integers little-endian):
+//   "TTGR"  u8 format  u8 n  u8 cellRun  u8 gridRun  u16 engineVersion  u64 seed
+//   varint moveCount  u32 checksum  then moveCount varints, each grid * n * n + cell
+// The checksum is FNV-1a over the encoded move bytes. Each move names its
+// grid, so a replay does not need the random grid draws. Format 1 records
+// carry no run lengths and were played with full lines.
+struct GameRecord {
+    static const uint8_t Format = 2;
+
+    int n = 0;
+    WinRule rule;
+    uint16_t engineVersion = 0;
+    uint64_t seed = 0;
+    vector<uint32_t> moves;
+
+    // Appends the game's move history as one record to `out`.
+    static void encode(const TicTacToe& game, uint64_t seed, vector<uint8_t>& out) {
+        int n = game.size();
+        WinRule rule = game.rule();
+        out.insert(out.end(), {'T', 'T', 'G', 'R', Format, uint8_t(n), uint8_t(rule.cellRun), uint8_t(rule.gridRun)});
+        putLittle(out, EngineVersion, 2);
+        putLittle(out, seed, 8);
+        putVarint(out, uint64_t(game.moveCount()));
+        size_t checksumAt = out.size();
+        putLittle(out, 0, 4);
+
+        size_t movesAt = out.size();
+        for (int i = 0; i < game.moveCount(); ++i) {
+            Move m = game.moveAt(i);
+            putVarint(out, uint64_t(m.grid) * n * n + m.cell);
+        }
+        uint32_t sum = checksum(&out[movesAt], out.size() - movesAt);
+        for (int b = 0; b < 4; ++b) out[checksumAt + b] = uint8_t(sum >> (8 * b));
+    }
+
+    static uint32_t checksum(const uint8_t* data, size_t size) {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < size; ++i) h = (h ^ data[i]) * 16777619u;
+        return h;
+    }
+
+    static void putVarint(vector<uint8_t>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(uint8_t(value) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(uint8_t(value));
+    }
+
+    static void putLittle(vector<uint8_t>& out, uint64_t value, int bytes) {
+        for (int b = 0; b < bytes; ++b) out.push_back(uint8_t(value >> (8 * b)));
+    }
+};
+
+// Appends encoded records to an archive. append() is safe to call from many
+// threads; callers batch records so the lock is taken once per batch.
+class GameRecordWriter {
+public:
+    explicit GameRecordWriter(const string& path) : file(fopen(path.c_str(), "ab")) {}
+    ~GameRecordWriter() {
+        if (file) fclose(file);
+    }
+
+    bool ok() const { return file != nullptr; }
+
+    void append(const vector<uint8_t>& bytes) {
+        if (!file || bytes.empty()) return;
+        lock_guard<mutex> guard(lock);
+        fwrite(bytes.data(), 1, bytes.size(), file);
+    }
+
+private:
+    FILE* file;
+    mutex lock;
+};
+
+// Reads an archive one record at a time through a fixed-size buffer, so
+// memory stays bounded whatever the archive size.
+class GameRecordReader {
+public:
+    explicit GameRecordReader(const string& path)
+        : file(fopen(path.c_str(), "rb")), buffer(1 << 20), begin(0), end(0), corrupt(false) {}
+    ~GameRecordReader() {
+        if (file) fclose(file);
+    }
+
+    bool ok() const { return file != nullptr; }
+    // True if reading stopped at a bad magic, truncated record or checksum mismatch.
+    bool failed() const { return corrupt; }
+
+    // Reads the next record into `record`, reusing its move buffer.
+    bool next(GameRecord& record) {
+        uint8_t header[8];
+        if (!read(header, 1)) return false;  // clean end of archive
+        if (!read(header + 1, 5) || header[0] != 'T' || header[1] != 'T' || header[2] != 'G' ||
+            header[3] != 'R' || header[4] < 1 || header[4] > GameRecord::Format) {
+            return fail();
+        }
+        record.n = header[5];
+        if (record.n < 4 || record.n > TicTacToe::MaxSize) return fail();  // the checksum does not cover n
+        record.rule = WinRule();
+        if (header[4] >= 2) {
+            if (!read(header + 6, 2)) return fail();
+            record.rule = WinRule{header[6], header[7]};
+        }
+        uint64_t version, seed, count, sum;
+        if (!little(version, 2) || !little(seed, 8) || !varint(count) || !little(sum, 4)) return fail();
+        uint64_t cells = uint64_t(record.n) * record.n * record.n * record.n;
+        if (count > cells) return fail();  // a game has at most one move per cell
+        record.engineVersion = uint16_t(version);
+        record.seed = seed;
+
+        uint32_t h = 2166136261u;
+        record.moves.clear();
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t move = 0;
+            for (int shift = 0;; shift += 7) {
+                uint8_t byte;
+                if (shift > 35 || !read(&byte, 1)) return fail();
+                h = (h ^ byte) * 16777619u;
+                move |= uint64_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) break;
+            }
+            if (move >= cells) return fail();
+            record.moves.push_back(uint32_t(move));
+        }
+        if (h != uint32_t(sum)) return fail();
+        return true;
+    }
+
+private:
+    FILE* file;
+    vector<uint8_t> buffer;
+    size_t begin;
+    size_t end;
+    bool corrupt;
+
+    bool fail() {
+        corrupt = true;
+        return false;
+    }
+
+    bool read(uint8_t* out, size_t size) {
+        while (size > 0) {
+            if (begin == end) {
+                if (!file) return false;
+                end = fread(buffer.data(), 1, buffer.size(), file);
+                begin = 0;
+                if (end == 0) return false;
+            }
+            size_t take = min(size, end - begin);
+            memcpy(out, &buffer[begin], take);
+            begin += take;
+            out += take;
+            size -= take;
+        }
+        return true;
+    }
+
+    bool little(uint64_t& value, int bytes) {
+        uint8_t raw[8];
+        if (!read(raw, size_t(bytes))) return false;
+        value = 0;
+        for (int b = 0; b < bytes; ++b) value |= uint64_t(raw[b]) << (8 * b);
+        return true;
+    }
+
+    bool varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift <= 63; shift += 7) {
+            uint8_t byte;
+            if (!read(&byte, 1)) return false;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+};
+
+// Replays a record on `game` (which must be a fresh board of the record's n),
+// rendering nothing. False if a move is illegal.
+bool replayGame(TicTacToe& game, const GameRecord& record) {
+    uint32_t cells = uint32_t(record.n * record.n);
+    for (uint32_t move : record.moves) {
+        int g = int(move / cells);
+        if (g >= int(cells)) return false;
+        game.setActiveGrid(g);
+        if (game.applyMove(Move{g, int(move % cells)}) == MoveResult::Invalid) return false;
+    }
+    return true;
+}
+
+// Fixed-stride training positions in a memory-mapped file, laid out so a
+// trainer can mmap it and view each plane as a uint8 array with no parsing.
+//   header (64 bytes): "TTDS" u32 version u32 n u32 stride u64 count u8 cellRun
+//                      u8 gridRun, zero padded
+//   record i at 64 + i * stride (stride rounded up to 8 bytes):
+//     n^4  X plane        1 where X holds the cell, sub-grid-major like FlatBoard
+//     n^4  O plane
+//     n^2  winner plane   0 open, 1 won by X, 2 won by O, 3 closed without a winner
+//     n^2  active plane   1 on the sub-grid the side to move must play in
+//     u8   side to move   0 X, 1 O
+//     i8   outcome        +1 X won, -1 O won, 0 draw
+//     u8   valid          0 for padding slots of games shorter than the sample count
+//     u8   reserved
+//     u32  ply
+//     u64  canonicalHash(), equal for symmetric positions, for deduplication
+// Records are preassigned by game index, so any thread may fill any game's
+// slice without coordination.
+class PositionDataset {
+public:
+    static const uint32_t Version = 2;
+    static const size_t HeaderBytes = 64;
+
+    static size_t strideFor(int n) {
+        size_t bytes = size_t(2) * n * n * n * n + size_t(2) * n * n + 16;
+        return (bytes + 7) & ~size_t(7);
+    }
+
+    PositionDataset(const string& path, int n, uint64_t count, WinRule rule = WinRule())
+        : n(n), stride(strideFor(n)), count(count), bytes(HeaderBytes + stride * count), base(nullptr) {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return;
+        if (ftruncate(fd, off_t(bytes)) == 0) {
+            void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapped != MAP_FAILED) base = static_cast<uint8_t*>(mapped);
+        }
+        close(fd);
+        if (!base) return;
+
+        memcpy(base, "TTDS", 4);
+        uint32_t fields[3] = {Version, uint32_t(n), uint32_t(stride)};
+        memcpy(base + 4, fields, sizeof(fields));
+        memcpy(base + 16, &count, sizeof(count));
+        base[24] = uint8_t(rule.resolved(n).cellRun);
+        base[25] = uint8_t(rule.resolved(n).gridRun);
+    }
+
+    ~PositionDataset() {
+        if (base) {
+            msync(base, bytes, MS_SYNC);
+            munmap(base, bytes);
+        }
+    }
+
+    bool ok() const { return base != nullptr; }
+    uint64_t size() const { return count; }
+
+    // Writes the game's current position as record i.
+    void write(uint64_t i, const TicTacToe& game, int outcome) {
+        uint8_t* out = base + HeaderBytes + i * stride;
+        size_t cells = size_t(n) * n * n * n;
+        const char* board = game.cells().grid(0);
+        for (size_t c = 0; c < cells; ++c) {
+            out[c] = board[c] == 'X';
+            out[cells + c] = board[c] == 'O';
+        }
+        uint8_t* winners = out + 2 * cells;
+        uint8_t* active = winners + n * n;
+        for (int g = 0; g < n * n; ++g) {
+            char w = game.gridWinner(g / n, g % n);
+            winners[g] = w == 'X' ? 1 : w == 'O' ? 2 : game.gridOpen(g) ? 0 : 3;
+            active[g] = g == game.activeGrid();
+        }
+        uint8_t* tail = active + n * n;
+        tail[0] = uint8_t(TicTacToe::playerIndex(game.toMove()));
+        tail[1] = uint8_t(int8_t(outcome));
+        tail[2] = 1;
+        tail[3] = 0;
+        uint32_t ply = uint32_t(game.moveCount());
+        memcpy(tail + 4, &ply, sizeof(ply));
+        uint64_t canonical = game.canonicalHash();
+        memcpy(tail + 8, &canonical, sizeof(canonical));
+    }
+
+    // Marks record i as an unused padding slot.
+    void clear(uint64_t i) { memset(base + HeaderBytes + i * stride, 0, stride); }
+
+private:
+    int n;
+    size_t stride;
+    uint64_t count;
+    size_t bytes;
+    uint8_t* base;
+};
+
+// Hands out game indices [0, total) to workers. Each worker owns a range and
+// takes from its front; an idle worker steals the back half of another's range.
+// A range is one atomic word (begin in the low half, end in the high half).
+class WorkStealingQueue {
+public:
+    WorkStealingQueue(uint32_t total, int workers) : count(workers), ranges(new Range[workers]) {
+        for (int w = 0; w < workers; ++w) {
+            uint32_t begin = uint32_t(uint64_t(total) * w / workers);
+            uint32_t end = uint32_t(uint64_t(total) * (w + 1) / workers);
+            ranges[w].bounds.store(pack(begin, end), memory_order_relaxed);
+        }
+    }
+
+    bool next(int worker, uint32_t& index) {
+        atomic<uint64_t>& own = ranges[worker].bounds;
+        uint64_t r = own.load(memory_order_acquire);
+        while (low(r) < high(r)) {
+            if (own.compare_exchange_weak(r, pack(low(r) + 1, high(r)), memory_order_acq_rel)) {
+                index = low(r);
+                return true;
+            }
+        }
+        for (;;) {
+            int victim = -1;
+            uint32_t most = 0;
+            for (int w = 0; w < count; ++w) {
+                uint64_t v = ranges[w].bounds.load(memory_order_acquire);
+                if (w != worker && high(v) - low(v) > most && low(v) < high(v)) {
+                    most = high(v) - low(v);
+                    victim = w;
+                }
+            }
+            if (victim < 0) return false;
+
+            atomic<uint64_t>& theirs = ranges[victim].bounds;
+            uint64_t v = theirs.load(memory_order_acquire);
+            if (low(v) >= high(v)) continue;
+            uint32_t mid = low(v) + (high(v) - low(v)) / 2;
+            if (!theirs.compare_exchange_strong(v, pack(low(v), mid), memory_order_acq_rel)) continue;
+            own.store(pack(mid + 1, high(v)), memory_order_release);
+            index = mid;
+            return true;
+        }
+    }
+
+private:
+    struct alignas(64) Range {
+        atomic<uint64_t> bounds{0};
+    };
+
+    int count;
+    unique_ptr<Range[]> ranges;
+
+    static uint64_t pack(uint32_t begin, uint32_t end) { return uint64_t(end) << 32 | begin; }
+    static uint32_t low(uint64_t r) { return uint32_t(r); }
+    static uint32_t high(uint64_t r) { return uint32_t(r >> 32); }
+};
+
+// Plays random moves with play()'s rules (random open grid, then a random
+// empty cell in it) until the game ends, drawing from rng.
+template <class Rng>
+void playRandomGame(TicTacToe& game, Rng& rng) {
+    while (game.status() == GameStatus::InProgress) {
+        game.drawActiveGrid(rng);
+        game.applyMove(game.randomMove(rng));
+    }
+}
+
+// The same, drawing from the engine's own generator.
+void playRandomGame(TicTacToe& game) { playRandomGame(game, game.random()); }
+
+struct SelfPlayStats {
+    long long games = 0;
+    long long xWins = 0;
+    long long oWins = 0;
+    long long draws = 0;
+    long long moves = 0;
+
+    void add(const SelfPlayStats& other) {
+        games += other.games;
+        xWins += other.xWins;
+        oWins += other.oWins;
+        draws += other.draws;
+        moves += other.moves;
+    }
+};
+
+// Plays a batch of random games across a thread pool, one engine per thread.
+// Game i is seeded from (seed, i), so results do not depend on scheduling.
+class SelfPlayFarm {
+public:
+    SelfPlayFarm(int n, uint64_t seed, WinRule rule = WinRule())
+        : n(n), seed(seed), rule(rule), pcg(false), recorder(nullptr), dataset(nullptr), samples(0) {}
+
+    // Draw the moves from a Pcg32 per thread instead of the engine's Xoshiro256.
+    void usePcg(bool on) { pcg = on; }
+
+    // Archive every finished game to `writer`.
+    void recordTo(GameRecordWriter* writer) { recorder = writer; }
+
+    // Export `perGame` positions of game i into records [i * perGame, (i + 1) * perGame).
+    void exportTo(PositionDataset* positions, int perGame) {
+        dataset = positions;
+        samples = perGame;
     }
 
-    void play() {
-        srand(time(0));
-        string input;
-        
-        while (true) {
-            int mainX, mainY;
-            do {
-                mainX = rand() % n;
-                mainY = rand() % n;
-            } while (mainGridWinners[mainX][mainY] != '.');
+    SelfPlayStats run(uint32_t games, int threads) {
+        WorkStealingQueue queue(games, threads);
+        vector<SelfPlayStats> perThread(threads);
+        vector<thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([this, &queue, &perThread, t] { work(queue, t, perThread[t]); });
+        }
+        for (thread& w : workers) w.join();
 
-            cout << "\nCurrent grid: (" << mainX + 1 << ", " << mainY + 1 << ")\n";
-            displayBoard(mainX, mainY);
+        SelfPlayStats total;
+        for (const SelfPlayStats& s : perThread) total.add(s);
+        return total;
+    }
 
-            cout << "Player " << currentPlayer << ", enter your move (row and column 1 to " << n << ", or 'Quit' to end): ";
-            cin >> input;
-            
-            // Check for quit command
-            if (input == "Quit" || input == "quit") {
-                cout << "\nGame ended by player. Thanks for playing!\n";
-                return;
-            }
-            
-            // Try to parse move
-            int subX, subY;
-            try {
-                subX = stoi(input);  // Convert first input to number
-                if (!(cin >> subY)) {    // Read second number
-                    cin.clear();
-                    cin.ignore(10000, '\n');
-                    cout << "Invalid input. Please enter two numbers or 'Quit'.\n";
-                    continue;
-                }
-            } catch (const invalid_argument&) {
-                cout << "Invalid input. Please enter two numbers or 'Quit'.\n";
-                continue;
+private:
+    int n;
+    uint64_t seed;
+    WinRule rule;
+    bool pcg;
+    GameRecordWriter* recorder;
+    PositionDataset* dataset;
+    int samples;
+
+    // Writes `samples` distinct plies of the finished game, chosen uniformly,
+    // by undoing back to each one from the end. Leaves the game part-undone.
+    void exportPositions(TicTacToe& game, uint32_t index, vector<int>& plies) {
+        int outcome = game.status() == GameStatus::XWins ? 1 : game.status() == GameStatus::OWins ? -1 : 0;
+        int length = game.moveCount();
+        plies.resize(length);
+        for (int p = 0; p < length; ++p) plies[p] = p;
+        int take = min(samples, length);
+        for (int k = 0; k < take; ++k) swap(plies[k], plies[k + uniformBelow(game.random(), uint32_t(length - k))]);
+        sort(plies.begin(), plies.begin() + take, greater<int>());
+
+        uint64_t first = uint64_t(index) * samples;
+        for (int k = 0; k < take; ++k) {
+            Move next = game.moveAt(plies[k]);
+            while (game.moveCount() > plies[k]) game.undoMove();
+            game.setActiveGrid(next.grid);
+            dataset->write(first + k, game, outcome);
+        }
+        for (int k = take; k < samples; ++k) dataset->clear(first + k);
+    }
+
+    void work(WorkStealingQueue& queue, int worker, SelfPlayStats& stats) {
+        TicTacToe game(n, WinCheck::Counters, 1, rule);
+        Pcg32 generator(1);
+        vector<uint8_t> records;
+        vector<int> plies;
+        uint32_t index;
+        while (queue.next(worker, index)) {
+            uint64_t gameSeed = seed ^ (uint64_t(index) * 0x9e3779b97f4a7c15ULL);
+            game.reset(gameSeed);
+
+            if (pcg) {
+                generator.seed(gameSeed);
+                playRandomGame(game, generator);
+            } else {
+                playRandomGame(game);
             }
 
-            if (isValidMove(mainX, mainY, subX - 1, subY - 1)) {
-                board[mainX][mainY][(subX - 1) * n + (subY - 1)] = currentPlayer;
-                
-                if (checkWin(mainX, mainY)) {
-                    displayBoard(mainX, mainY);
-                    cout << "Player " << currentPlayer << " wins grid (" << mainX + 1 << "," << mainY + 1 << ")!\n";
-                    mainGridWinners[mainX][mainY] = currentPlayer;
-                    
-                    // Only check for game end if this player has won multiple grids
-                    if (checkMainGridWin()) {
-                        displayBoard(mainX, mainY);
-                        cout << "Player " << currentPlayer << " wins the entire game!\n";
-                        return;  // End the game only on main grid win
-                    }
+            if (recorder) {
+                GameRecord::encode(game, gameSeed, records);
+                if (records.size() >= (1 << 20)) {
+                    recorder->append(records);
+                    records.clear();
                 }
-                
-                togglePlayer();  // Switch players after a valid move
-            } else {
-                cout << "Invalid move. Try again.\n";
             }
+
+            ++stats.games;
+            stats.moves += game.moveCount();
+            if (game.status() == GameStatus::XWins) ++stats.xWins;
+            else if (game.status() == GameStatus::OWins) ++stats.oWins;
+            else ++stats.draws;
+
+            if (dataset) exportPositions(game, index, plies);
         }
+        if (recorder) recorder->append(records);
     }
+};
 
-private:
-    int n;
-    char currentPlayer;
-    vector<vector<vector<char> > > board;
-    vector<vector<char> > mainGridWinners;
+// stats=PATH writes the instrumentation counters as JSON ("-" for stdout).
+bool writeStats(const Options& args) {
+    if (!args.has("stats")) return true;
+    string path = args.get("stats");
+    if (path == "-" || path.empty()) {
+        Instrumentation::writeJson(cout);
+        return true;
+    }
+    ofstream out(path);
+    Instrumentation::writeJson(out);
+    return bool(out);
+}
 
-    void togglePlayer() {
-        currentPlayer = (currentPlayer == 'X') ? 'O' : 'X';
+// "selfplay": plays games=N random games on threads=T and prints the results.
+// rng=pcg draws the moves from Pcg32 rather than the default rng=xoshiro.
+int runSelfPlay(const Options& args) {
+    if (!validSizeAndThreads(args)) return 1;
+    int n = int(args.number("n", 4));
+    uint32_t games = uint32_t(args.number("games", 10000));
+    int threads = int(args.number("threads", max(1u, thread::hardware_concurrency())));
+    WinRule rule = winRule(args);
+    string generator = args.get("rng", "xoshiro");
+    if (generator != "xoshiro" && generator != "pcg") {
+        cout << "rng must be xoshiro or pcg.\n";
+        return 1;
+    }
+    SelfPlayFarm farm(n, uint64_t(args.number("seed", 1)), rule);
+    farm.usePcg(generator == "pcg");
+    unique_ptr<GameRecordWriter> writer;
+    if (args.has("record")) {
+        writer.reset(new GameRecordWriter(args.get("record")));
+        if (!writer->ok()) {
+            cout << "Cannot open " << args.get("record") << " for writing.\n";
+            return 1;
+        }
+        farm.recordTo(writer.get());
+    }
+    unique_ptr<PositionDataset> dataset;
+    if (args.has("dataset")) {
+        int samples = int(args.number("samples", 8));
+        dataset.reset(new PositionDataset(args.get("dataset"), n, uint64_t(games) * samples, rule));
+        if (!dataset->ok()) {
+            cout << "Cannot map " << args.get("dataset") << " for writing.\n";
+            return 1;
+        }
+        farm.exportTo(dataset.get(), samples);
     }
 
-    bool isValidMove(int mainX, int mainY, int subX, int subY) {
-        if (mainGridWinners[mainX][mainY] != '.') {
-            cout << "This grid has already been won by Player " << mainGridWinners[mainX][mainY] << "!\n";
-            return false;
+    auto start = chrono::steady_clock::now();
+    SelfPlayStats stats = farm.run(games, threads);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "n=" << n << " threads=" << threads << " games=" << stats.games << " x_wins=" << stats.xWins
+         << " o_wins=" << stats.oWins << " draws=" << stats.draws
+         << " avg_moves=" << double(stats.moves) / max(1LL, stats.games) << " seconds=" << seconds
+         << " games_per_sec=" << long(stats.games / seconds) << "\n";
+    return writeStats(args) ? 0 : 1;
+}
+
+// "replay": streams every record of file=PATH through the engine and checks it.
+int runReplay(const Options& args) {
+    GameRecordReader reader(args.get("file"));
+    if (!reader.ok()) {
+        cout << "Cannot open " << args.get("file") << ".\n";
+        return 1;
+    }
+
+    GameRecord record;
+    SelfPlayStats stats;
+    long long illegal = 0;
+    unique_ptr<TicTacToe> game;
+    auto start = chrono::steady_clock::now();
+    while (reader.next(record)) {
+        if (!game || game->size() != record.n || !game->rule().sameAs(record.rule, record.n)) {
+            game.reset(new TicTacToe(record.n, WinCheck::Counters, 1, record.rule));
         }
-        return subX >= 0 && subY >= 0 && subX < n && subY < n && board[mainX][mainY][subX * n + subY] == '.';
+        while (game->undoMove()) {}
+        game->setActiveGrid(-1);
+
+        if (!replayGame(*game, record)) ++illegal;
+        ++stats.games;
+        stats.moves += game->moveCount();
+        if (game->status() == GameStatus::XWins) ++stats.xWins;
+        else if (game->status() == GameStatus::OWins) ++stats.oWins;
+        else if (game->status() == GameStatus::Draw) ++stats.draws;
     }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    void displayBoard(int activeMainX, int activeMainY) {
-        cout << "\nFull Board (Active grid: " << activeMainX + 1 << "," << activeMainY + 1 << ")\n\n";
-        
-        // For each row of sub-grids
-        for (int mainRow = 0; mainRow < n; mainRow++) {
-            // For each row within the sub-grids
-            for (int subRow = 0; subRow < n; subRow++) {
-                // For each column of sub-grids
-                for (int mainCol = 0; mainCol < n; mainCol++) {
-                    // Draw the sub-grid row
-                    for (int subCol = 0; subCol < n; subCol++) {
-                        // Highlight active grid with brackets
-                        if (mainRow == activeMainX && mainCol == activeMainY) {
-                            cout << "[" << board[mainRow][mainCol][subRow * n + subCol] << "]";
-                        } else {
-                            cout << " " << board[mainRow][mainCol][subRow * n + subCol] << " ";
-                        }
-                    }
-                    // Add separator between sub-grids
-                    if (mainCol < n - 1) cout << " | ";
-                }
-                cout << endl;
+    cout << "games=" << stats.games << " x_wins=" << stats.xWins << " o_wins=" << stats.oWins
+         << " draws=" << stats.draws << " illegal=" << illegal << " corrupt=" << (reader.failed() ? 1 : 0)
+         << " moves_per_sec=" << long(stats.moves / max(seconds, 1e-9)) << "\n";
+    return reader.failed() || illegal ? 1 : 0;
+}
+
+// Builds a position book from games= seeded random games: every position in
+// the first opening= and the last endgame= plies of each game is searched,
+// and kept if the search reached depth= or proved a forced result.
+int runBuildBook(const Options& args) {
+    if (!validSizeAndThreads(args)) return 1;
+    int n = int(args.number("n", 4));
+    int games = int(args.number("games", 200));
+    int opening = int(args.number("opening", 4));
+    int endgame = int(args.number("endgame", 8));
+    uint64_t seed = uint64_t(args.number("seed", 1));
+    string path = args.get("out", "book.ttbk");
+    SearchLimits limits;
+    limits.maxDepth = int(args.number("depth", 4));
+    limits.maxNodes = args.number("nodes", 50000);
+
+    TicTacToe game(n, WinCheck::Counters, seed, winRule(args));
+    AIPlayer ai(n, size_t(args.number("tt", 16)));
+    map<uint64_t, PositionBook::Entry> known;
+    long long searched = 0, solved = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < games; ++i) {
+        game.reset(seed ^ (uint64_t(i) * 0x9e3779b97f4a7c15ULL));
+        playRandomGame(game);
+        int length = game.moveCount();
+        for (int ply = length - 1; ply >= 0; --ply) {
+            if (ply >= opening && ply < length - endgame) continue;
+            Move played = game.moveAt(ply);
+            while (game.moveCount() > ply) game.undoMove();
+            game.setActiveGrid(played.grid);
+            uint64_t key = game.canonicalHash();
+            if (known.count(key)) continue;
+
+            SearchResult result = ai.search(game, limits);
+            ++searched;
+            bool forced = result.score >= AIPlayer::WinScore - 64 || result.score <= -AIPlayer::WinScore + 64;
+            if (result.depth < limits.maxDepth && !forced) continue;
+            PositionBook::Entry entry;
+            entry.move = game.symmetries().apply(game.canonicalTransform(), result.best);
+            entry.score = result.score;
+            entry.depth = result.depth;
+            entry.solved = forced;
+            known[key] = entry;
+            solved += forced;
+        }
+    }
+
+    vector<pair<uint64_t, PositionBook::Entry> > entries(known.begin(), known.end());
+    if (!PositionBook::write(path, n, game.rule(), entries)) {
+        cout << "Cannot write " << path << ".\n";
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "positions=" << entries.size() << " solved=" << solved << " searched=" << searched
+         << " seconds=" << seconds << " file=" << path << "\n";
+    return 0;
+}
+
+// Micro-benchmarks for the engine hot paths, one JSON object per line:
+//   {"bench":"check_win","variant":"counters","n":6,"batch":512,"samples":200,
+//    "p50_ns":..,"p90_ns":..,"p99_ns":..,"ops_per_sec":..}
+// Latencies are per call, taken from batches sized to run for at least
+// ~20us so clock overhead stays out of the percentiles.
+class EngineBench {
+public:
+    explicit EngineBench(uint64_t seed) : seed(seed), sink(0), failures(0) {}
+
+    void run(int n, const string& only) {
+        const WinCheck modes[] = {WinCheck::Scan, WinCheck::Bitboard, WinCheck::Counters};
+        const char* names[] = {"scan", "bitboard", "counters"};
+        for (int m = 0; m < 3; ++m) {
+            TicTacToe game(n, modes[m], seed);
+            midgame(game);
+            vector<Move> moves = occupied(game);
+            size_t i = 0;
+            if (wanted(only, "check_win")) {
+                measure("check_win", names[m], n, [&] {
+                    const Move& mv = moves[i++ % moves.size()];
+                    sink += game.checkWin(mv.grid / n, mv.grid % n, mv.cell / n, mv.cell % n);
+                });
             }
-            // Add horizontal separator between rows of sub-grids
-            if (mainRow < n - 1) {
-                cout << string(n * (n * 3 + 2) - 1, '-') << endl;
+            if (wanted(only, "check_main_grid_win")) {
+                measure("check_main_grid_win", names[m], n, [&] {
+                    int g = int(i++ % size_t(n * n));
+                    sink += game.checkMainGridWin(g / n, g % n);
+                });
             }
         }
-        cout << endl;
-    }
 
-    bool checkWin(int mainX, int mainY) {
-        // Check rows
-        for (int i = 0; i < n; ++i) {
-            bool win = true;
-            for (int j = 0; j < n; ++j) {
-                if (board[mainX][mainY][i * n + j] != currentPlayer) {
-                    win = false;
-                    break;
-                }
+        TicTacToe game(n, WinCheck::Counters, seed);
+        midgame(game);
+        int cells = n * n * n * n;
+        size_t i = 0;
+        if (wanted(only, "is_valid_move")) {
+            measure("is_valid_move", "", n, [&] {
+                int c = int(i++ % size_t(cells));
+                int g = c / (n * n), s = c % (n * n);
+                sink += game.isValidMove(g / n, g % n, s / n, s % n);
+            });
+        }
+
+        vector<Move> legal;
+        if (wanted(only, "legal_moves")) {
+            measure("legal_moves", "active_grid", n, [&] {
+                game.setActiveGrid(game.randomOpenGrid(game.random()));
+                game.legalMoves(legal);
+                sink += legal.size();
+            });
+            measure("legal_moves", "any_grid", n, [&] {
+                game.setActiveGrid(-1);
+                game.legalMoves(legal);
+                sink += legal.size();
+            });
+        }
+
+        if (wanted(only, "make_unmake")) {
+            game.setActiveGrid(-1);
+            game.legalMoves(legal);
+            measure("make_unmake", "", n, [&] {
+                game.setActiveGrid(-1);
+                game.applyMove(legal[i++ % legal.size()]);
+                game.undoMove();
+            });
+        }
+
+        if (wanted(only, "random_playout")) {
+            int start = game.moveCount();
+            measure("random_playout", "", n, [&] {
+                playRandomGame(game);
+                sink += game.moveCount();
+                while (game.moveCount() > start) game.undoMove();
+            });
+        }
+
+        if (wanted(only, "packed_board")) {
+            BumpArena scratch(FlatBoard::footprint(n));
+            FlatBoard unpacked(n, '.', scratch);
+            PackedBoard(game.cells()).unpack(unpacked);
+            if (memcmp(unpacked.grid(0), game.cells().grid(0), size_t(cells)) != 0) {
+                printf("{\"bench\":\"packed_board\",\"n\":%d,\"error\":\"round trip mismatch\"}\n", n);
+                failures++;
             }
-            if (win) return true;
+            measure("packed_board", "pack_unpack", n, [&] {
+                PackedBoard packed(game.cells());
+                packed.unpack(unpacked);
+                sink += unpacked.grid(0)[i++ % size_t(cells)];
+            });
         }
-        
-        // Check columns
-        for (int j = 0; j < n; ++j) {
-            bool win = true;
-            for (int i = 0; i < n; ++i) {
-                if (board[mainX][mainY][i * n + j] != currentPlayer) {
-                    win = false;
-                    break;
-                }
+
+        if (wanted(only, "snapshot")) {
+            vector<uint8_t> saved, again;
+            game.snapshot(saved);
+            int start = game.moveCount();
+            playRandomGame(game);
+            bool restored = game.restore(saved);
+            game.snapshot(again);
+            if (!restored || again != saved || game.moveCount() != start) {
+                printf("{\"bench\":\"snapshot\",\"n\":%d,\"error\":\"round trip mismatch\"}\n", n);
+                failures++;
             }
-            if (win) return true;
+            measure("snapshot", "save_restore", n, [&] {
+                game.snapshot(saved.data());
+                sink += game.restore(saved);
+            });
         }
-        
-        // Check diagonals
-        bool win = true;
-        for (int i = 0; i < n; ++i) {
-            if (board[mainX][mainY][i * n + i] != currentPlayer) {
-                win = false;
+
+        if (wanted(only, "render")) {
+            BoardRenderer full(n);
+            measure("render", "full", n, [&] {
+                full.render(game, 0, 0);
+                sink += full.frame().size();
+            });
+            BoardRenderer diff(n, true);
+            diff.render(game, 0, 0);
+            measure("render", "ansi_diff", n, [&] {
+                diff.render(game, 0, 0);
+                sink += diff.frame().size();
+            });
+        }
+    }
+
+    // Keeps the optimizer from discarding the measured calls.
+    uint64_t checksum() const { return sink; }
+    // Self-checks that failed, such as a PackedBoard round trip.
+    int failed() const { return failures; }
+
+private:
+    uint64_t seed;
+    uint64_t sink;
+    int failures;
+
+    static bool wanted(const string& only, const char* name) { return only.empty() || only == name; }
+
+    // Plays random moves until a third of the cells are filled, stopping short of a finished game.
+    static void midgame(TicTacToe& game) {
+        int n = game.size();
+        while (game.moveCount() < n * n * n * n / 3) {
+            game.drawActiveGrid();
+            Move m = game.randomMove(game.random());
+            game.applyMove(m);
+            if (game.status() != GameStatus::InProgress) {
+                game.undoMove();
                 break;
             }
         }
-        if (win) return true;
-        
-        win = true;
-        for (int i = 0; i < n; ++i) {
-            if (board[mainX][mainY][i * n + (n - 1 - i)] != currentPlayer) {
-                win = false;
-                break;
+        game.setActiveGrid(-1);
+    }
+
+    static vector<Move> occupied(const TicTacToe& game) {
+        vector<Move> moves;
+        for (int i = 0; i < game.moveCount(); ++i) moves.push_back(game.moveAt(i));
+        if (moves.empty()) moves.push_back(Move{0, 0});
+        return moves;
+    }
+
+    template <class F>
+    void measure(const char* bench, const char* variant, int n, F call) {
+        using Clock = chrono::steady_clock;
+        auto timeBatch = [&](long batch) {
+            auto start = Clock::now();
+            for (long b = 0; b < batch; ++b) call();
+            return chrono::duration<double, nano>(Clock::now() - start).count();
+        };
+
+        long batch = 1;
+        while (batch < (1L << 24) && timeBatch(batch) < 20000) batch *= 2;
+
+        vector<double> perCall;
+        double total = 0;
+        while (perCall.size() < 200 && (perCall.size() < 20 || total < 3e8)) {
+            double ns = timeBatch(batch);
+            total += ns;
+            perCall.push_back(ns / batch);
+        }
+        sort(perCall.begin(), perCall.end());
+        auto pct = [&](double p) { return perCall[min(perCall.size() - 1, size_t(p * perCall.size()))]; };
+
+        printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"n\":%d,\"batch\":%ld,\"samples\":%zu,"
+               "\"p50_ns\":%.2f,\"p90_ns\":%.2f,\"p99_ns\":%.2f,\"ops_per_sec\":%.0f}\n",
+               bench, variant, n, batch, perCall.size(), pct(0.50), pct(0.90), pct(0.99),
+               1e9 * double(batch) * perCall.size() / total);
+        fflush(stdout);
+    }
+};
+
+int runBench(const Options& args) {
+    if (!validSizeAndThreads(args)) return 1;
+    vector<int> sizes = {4, 6, 8, 16};
+    if (args.has("n")) sizes = {int(args.number("n", 4))};
+    EngineBench bench(uint64_t(args.number("seed", 1)));
+    for (int n : sizes) bench.run(n, args.get("only"));
+    cerr << "checksum=" << bench.checksum() << "\n";
+    return bench.failed() ? 1 : 0;
+}
+
+// Counts legal move sequences of a given length from a position. Below the
+// root every ply may be played in any open sub-grid, covering each active
+// grid the random draw could pick. Subtree counts are shared between
+// threads through a lockless table keyed by position hash and depth, and
+// the root moves are split across threads, each working on its own copy of
+// the engine.
+class Perft {
+public:
+    Perft(size_t cacheMegabytes, int threads) : threads(max(1, threads)), mask(0) {
+        size_t count = 0;
+        if (cacheMegabytes > 0) {
+            count = 1;
+            while (count * 2 * sizeof(Slot) <= cacheMegabytes * 1024 * 1024) count *= 2;
+        }
+        slots = vector<Slot>(count);
+        mask = count ? count - 1 : 0;
+    }
+
+    uint64_t count(const TicTacToe& root, int depth) {
+        if (depth == 0) return 1;
+        vector<Move> rootMoves;
+        root.legalMoves(rootMoves);
+
+        atomic<size_t> next(0);
+        atomic<uint64_t> total(0);
+        auto worker = [&] {
+            TicTacToe game(root);
+            vector<vector<Move>> plies(depth);
+            uint64_t sum = 0;
+            for (size_t i; (i = next.fetch_add(1, memory_order_relaxed)) < rootMoves.size();) {
+                game.applyMove(rootMoves[i]);
+                game.setActiveGrid(-1);
+                sum += descend(game, depth - 1, plies);
+                game.undoMove();
             }
+            total.fetch_add(sum, memory_order_relaxed);
+        };
+
+        vector<thread> pool;
+        for (int t = 1; t < threads; ++t) pool.emplace_back(worker);
+        worker();
+        for (thread& t : pool) t.join();
+        return total.load();
+    }
+
+private:
+    struct Slot {
+        atomic<uint64_t> key{0};
+        atomic<uint64_t> data{0};
+    };
+
+    int threads;
+    vector<Slot> slots;
+    size_t mask;
+
+    static uint64_t cacheKey(uint64_t hash, int depth) { return hash ^ (uint64_t(depth) * 0x9e3779b97f4a7c15ULL); }
+
+    uint64_t descend(TicTacToe& game, int depth, vector<vector<Move>>& plies) {
+        if (depth == 0) return 1;
+        uint64_t key = cacheKey(game.canonicalHash(), depth);
+        if (!slots.empty()) {
+            const Slot& slot = slots[key & mask];
+            uint64_t data = slot.data.load(memory_order_relaxed);
+            if ((slot.key.load(memory_order_relaxed) ^ data) == key) return data;
         }
-        return win;
+
+        vector<Move>& moves = plies[depth];
+        game.legalMoves(moves);
+        uint64_t nodes = 0;
+        for (const Move& m : moves) {
+            game.applyMove(m);
+            game.setActiveGrid(-1);
+            nodes += descend(game, depth - 1, plies);
+            game.undoMove();
+        }
+
+        if (!slots.empty() && depth > 1) {
+            Slot& slot = slots[key & mask];
+            slot.key.store(key ^ nodes, memory_order_relaxed);
+            slot.data.store(nodes, memory_order_relaxed);
+        }
+        return nodes;
     }
+};
 
-    bool checkMainGridWin() {
-        char player = currentPlayer;
-        
-        // Check rows of main grid
-        for (int i = 0; i < n; ++i) {
-            bool win = true;
-            for (int j = 0; j < n; ++j) {
-                if (mainGridWinners[i][j] != player) {
-                    win = false;
-                    break;
+// Runs perft to each depth up to depth= on every WinCheck mode and checks
+// that they agree. setup=K plays K seeded random moves first.
+int runPerft(const Options& args) {
+    if (!validSizeAndThreads(args)) return 1;
+    int n = int(args.number("n", 4));
+    int depth = int(args.number("depth", 3));
+    int setup = int(args.number("setup", 0));
+    uint64_t seed = uint64_t(args.number("seed", 1));
+    size_t cache = size_t(args.number("cache", 64));
+    int threads = int(args.number("threads", max(1u, thread::hardware_concurrency())));
+
+    const WinCheck modes[] = {WinCheck::Scan, WinCheck::Bitboard, WinCheck::Counters};
+    const char* names[] = {"scan", "bitboard", "counters"};
+    vector<uint64_t> expected(depth + 1, 0);
+    bool match = true;
+    for (int m = 0; m < 3; ++m) {
+        TicTacToe game(n, modes[m], seed, winRule(args));
+        for (int i = 0; i < setup && game.status() == GameStatus::InProgress; ++i) {
+            game.drawActiveGrid();
+            game.applyMove(game.randomMove(game.random()));
+        }
+        game.setActiveGrid(-1);
+
+        Perft perft(cache, threads);
+        for (int d = 1; d <= depth; ++d) {
+            auto start = chrono::steady_clock::now();
+            uint64_t nodes = perft.count(game, d);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (m == 0) expected[d] = nodes;
+            else if (nodes != expected[d]) match = false;
+            cout << "engine=" << names[m] << " depth=" << d << " nodes=" << nodes << " seconds=" << seconds
+                 << " nodes_per_sec=" << long(nodes / max(seconds, 1e-9)) << "\n";
+        }
+    }
+    cout << "match=" << (match ? 1 : 0) << "\n";
+    return match ? 0 : 1;
+}
+
+// "analyze": plays setup= seeded random moves, draws the active grid, then
+// scores every legal move on threads= workers, each searching its own fork of
+// the position. Scores are for the side to move; the reply is searched as if
+// the opponent could pick any open grid, as AIPlayer does below the root.
+int runAnalyze(const Options& args) {
+    if (!validSizeAndThreads(args)) return 1;
+    int n = int(args.number("n", 4));
+    int setup = int(args.number("setup", 8));
+    uint64_t seed = uint64_t(args.number("seed", 1));
+    int threads = int(args.number("threads", max(1u, thread::hardware_concurrency())));
+    size_t tt = size_t(args.number("tt", 8));
+    SearchLimits limits;
+    limits.maxDepth = int(args.number("depth", 3));
+    limits.maxNodes = args.number("nodes", 20000);
+
+    TicTacToe root(n, WinCheck::Counters, seed, winRule(args));
+    for (int i = 0; i < setup && root.status() == GameStatus::InProgress; ++i) {
+        root.drawActiveGrid();
+        root.applyMove(root.randomMove(root.random()));
+    }
+    if (root.status() != GameStatus::InProgress) {
+        cout << "The game ended during setup.\n";
+        return 1;
+    }
+    root.drawActiveGrid();
+    vector<Move> moves;
+    root.legalMoves(moves);
+
+    vector<int> scores(moves.size());
+    atomic<size_t> next(0);
+    auto worker = [&] {
+        PositionFork fork(root);
+        AIPlayer ai(n, tt);
+        for (size_t i; (i = next.fetch_add(1, memory_order_relaxed)) < moves.size();) {
+            TicTacToe& game = fork.rewind();
+            MoveResult result = game.applyMove(moves[i]);
+            if (result == MoveResult::GameWon) scores[i] = AIPlayer::WinScore;
+            else if (game.status() == GameStatus::Draw) scores[i] = 0;
+            else scores[i] = -ai.search(game, limits).score;
+        }
+    };
+    auto start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (int t = 1; t < threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (thread& t : pool) t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<size_t> order(moves.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scores[a] > scores[b]; });
+    int g = root.activeGrid();
+    cout << "player=" << root.toMove() << " grid=" << g / n + 1 << "," << g % n + 1 << " moves=" << moves.size()
+         << " threads=" << threads << " seconds=" << seconds << "\n";
+    for (size_t i : order) {
+        cout << "move=" << moves[i].cell / n + 1 << "," << moves[i].cell % n + 1 << " score=" << scores[i] << "\n";
+    }
+    return 0;
+}
+
+// Readiness notification over a set of non-blocking descriptors: epoll on
+// Linux, poll() everywhere else.
+class EventLoop {
+public:
+    struct Event {
+        int fd;
+        bool readable;
+        bool writable;
+    };
+
+#ifdef __linux__
+    EventLoop() : epoll(epoll_create1(0)) {}
+    ~EventLoop() {
+        if (epoll >= 0) close(epoll);
+    }
+
+    bool ok() const { return epoll >= 0; }
+
+    void add(int fd) { control(EPOLL_CTL_ADD, fd, false); }
+    void watchWrites(int fd, bool on) { control(EPOLL_CTL_MOD, fd, on); }
+    void remove(int fd) { epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr); }
+
+    int wait(vector<Event>& out, int timeoutMillis) {
+        ready.resize(max<size_t>(ready.size(), 256));
+        int count = epoll_wait(epoll, ready.data(), int(ready.size()), timeoutMillis);
+        out.clear();
+        for (int i = 0; i < count; ++i) {
+            uint32_t e = ready[i].events;
+            out.push_back(Event{ready[i].data.fd, (e & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0, (e & EPOLLOUT) != 0});
+        }
+        return count;
+    }
+
+private:
+    int epoll;
+    vector<epoll_event> ready;
+
+    void control(int op, int fd, bool writes) {
+        epoll_event e{};
+        e.events = EPOLLIN | (writes ? uint32_t(EPOLLOUT) : 0);
+        e.data.fd = fd;
+        epoll_ctl(epoll, op, fd, &e);
+    }
+#else
+    bool ok() const { return true; }
+
+    void add(int fd) {
+        if (int(where.size()) <= fd) where.resize(fd + 1, -1);
+        where[fd] = int(fds.size());
+        fds.push_back(pollfd{fd, POLLIN, 0});
+    }
+    void watchWrites(int fd, bool on) { fds[where[fd]].events = short(POLLIN | (on ? POLLOUT : 0)); }
+    void remove(int fd) {
+        int i = where[fd];
+        fds[i] = fds.back();
+        where[fds[i].fd] = i;
+        fds.pop_back();
+        where[fd] = -1;
+    }
+
+    int wait(vector<Event>& out, int timeoutMillis) {
+        int count = ::poll(fds.data(), nfds_t(fds.size()), timeoutMillis);
+        out.clear();
+        for (size_t i = 0; i < fds.size() && int(out.size()) < count; ++i) {
+            short e = fds[i].revents;
+            if (e) out.push_back(Event{fds[i].fd, (e & (POLLIN | POLLHUP | POLLERR)) != 0, (e & POLLOUT) != 0});
+        }
+        return count;
+    }
+
+private:
+    vector<pollfd> fds;
+    vector<int> where;  // fd -> index in fds
+#endif
+};
+
+// Serves many concurrent games from one thread over TCP. Each connection is
+// a session in a slab; slots, their buffers and their engines are reused as
+// connections come and go. Line protocol, one command per line:
+//   new N [SEED [K]]  start a game on an N board (3 < N <= maxN), K in a row winning
+//                  sub-grids and the game (default N)  -> "ok N SEED", then a turn line
+//   move R C       play cell (R, C) of the active sub-grid
+//                  -> "placed" | "grid X|O" | "invalid", then a turn line
+//   undo           take back the last move              -> "ok", then a turn line
+//   board          -> "board CELLS WINNERS": the n^4 cells sub-grid-major, then the n^2 sub-grid winners ('-' drawn)
+//   quit
+// A turn line is "turn P GX GY" (P to move in sub-grid GX GY) or, once the
+// game is over, "over X|O|draw". Bad input gets "error REASON".
+class GameServer {
+public:
+    static const int InputBytes = 1024;
+
+    GameServer(int maxSessions, int maxN, uint64_t seed)
+        : maxSessions(maxSessions), maxN(min(maxN, TicTacToe::MaxSize)), seed(seed), listener(-1), started(0) {}
+
+    ~GameServer() {
+        for (auto& s : slots) {
+            if (s->fd >= 0) close(s->fd);
+        }
+        if (listener >= 0) close(listener);
+    }
+
+    bool listen(int port) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener < 0 || !loop.ok()) return false;
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(uint16_t(port));
+        if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) return false;
+        if (::listen(listener, 512) < 0) return false;
+        fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+        loop.add(listener);
+        return true;
+    }
+
+    void run() {
+        vector<EventLoop::Event> events;
+        for (;;) {
+            if (loop.wait(events, -1) < 0 && errno != EINTR) return;
+            for (const EventLoop::Event& e : events) {
+                int slot = -1;
+                // Running out of memory ends the session it happened in, not the server.
+                try {
+                    if (e.fd == listener) {
+                        acceptAll();
+                        continue;
+                    }
+                    slot = e.fd < int(slotOfFd.size()) ? slotOfFd[e.fd] : -1;
+                    if (slot < 0) continue;
+                    Session& s = *slots[slot];
+                    if (e.readable && !receive(s)) {
+                        finish(slot);
+                        continue;
+                    }
+                    if ((e.writable || s.sent < s.out.size()) && !flush(s)) finish(slot);
+                } catch (const bad_alloc&) {
+                    if (slot < 0 || slots[slot]->fd < 0) continue;
+                    slots[slot]->game.reset();
+                    finish(slot);
                 }
             }
-            if (win) return true;
         }
-        
-        // Check columns of main grid
-        for (int j = 0; j < n; ++j) {
-            bool win = true;
-            for (int i = 0; i < n; ++i) {
-                if (mainGridWinners[i][j] != player) {
-                    win = false;
-                    break;
-                }
+    }
+
+private:
+    struct Session {
+        int fd = -1;
+        bool closing = false;
+        bool watchingWrites = false;
+        size_t used = 0;  // bytes of `in` holding an unfinished line
+        char in[InputBytes];
+        vector<char> out;
+        size_t sent = 0;
+        unique_ptr<TicTacToe> game;
+    };
+
+    int maxSessions;
+    int maxN;          // largest board a client may ask for; memory grows as n^4
+    uint64_t seed;
+    int listener;
+    uint64_t started;
+    EventLoop loop;
+    vector<unique_ptr<Session> > slots;
+    vector<int> freeSlots;
+    vector<int> slotOfFd;
+
+    void acceptAll() {
+        for (;;) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) return;
+            if (freeSlots.empty() && int(slots.size()) >= maxSessions) {
+                close(fd);
+                continue;
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            int slot;
+            if (!freeSlots.empty()) {
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+            } else {
+                slot = int(slots.size());
+                slots.emplace_back(new Session);
+                slots.back()->out.reserve(4096);
             }
-            if (win) return true;
+            Session& s = *slots[slot];
+            s.fd = fd;
+            s.closing = false;
+            s.watchingWrites = false;
+            s.used = 0;
+            s.out.clear();
+            s.sent = 0;
+            if (int(slotOfFd.size()) <= fd) slotOfFd.resize(fd + 1, -1);
+            slotOfFd[fd] = slot;
+            loop.add(fd);
         }
-        
-        // Check diagonals of main grid
-        bool win = true;
-        for (int i = 0; i < n; ++i) {
-            if (mainGridWinners[i][i] != player) {
-                win = false;
-                break;
+    }
+
+    void finish(int slot) {
+        Session& s = *slots[slot];
+        loop.remove(s.fd);
+        close(s.fd);
+        slotOfFd[s.fd] = -1;
+        s.fd = -1;
+        freeSlots.push_back(slot);
+    }
+
+    // Reads what is available and runs every complete line; false once the peer is gone.
+    bool receive(Session& s) {
+        for (;;) {
+            ssize_t got = read(s.fd, s.in + s.used, InputBytes - s.used);
+            if (got == 0) return false;
+            if (got < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            s.used += size_t(got);
+
+            char* line = s.in;
+            char* end = s.in + s.used;
+            for (char* eol; (eol = static_cast<char*>(memchr(line, '\n', size_t(end - line)))) != nullptr; line = eol + 1) {
+                execute(s, line, eol);
+                if (s.closing) {
+                    flush(s);
+                    return false;
+                }
+            }
+            s.used = size_t(end - line);
+            memmove(s.in, line, s.used);
+            if (s.used == size_t(InputBytes)) {
+                put(s, "error line too long\n");
+                flush(s);
+                return false;
             }
         }
-        if (win) return true;
-        
-        win = true;
-        for (int i = 0; i < n; ++i) {
-            if (mainGridWinners[i][n - 1 - i] != player) {
-                win = false;
+    }
+
+    // Writes as much queued output as the socket takes, watching for
+    // writability only while some is left over.
+    bool flush(Session& s) {
+        while (s.sent < s.out.size()) {
+            ssize_t wrote = write(s.fd, s.out.data() + s.sent, s.out.size() - s.sent);
+            if (wrote < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
                 break;
             }
+            s.sent += size_t(wrote);
         }
-        return win;
+        if (s.sent == s.out.size()) {
+            s.out.clear();
+            s.sent = 0;
+        }
+        bool pending = !s.out.empty();
+        if (pending != s.watchingWrites) {
+            loop.watchWrites(s.fd, pending);
+            s.watchingWrites = pending;
+        }
+        return true;
     }
 
-    bool processInput(string& input, int& x, int& y) {
-        try {
-            x = stoi(input);
-            if (!(cin >> y)) {
-                cin.clear();
-                cin.ignore(10000, '\n');
-                return false;
+    static void put(Session& s, const char* text) { s.out.insert(s.out.end(), text, text + strlen(text)); }
+    static void put(Session& s, char c) { s.out.push_back(c); }
+    static void put(Session& s, uint64_t value) {
+        char digits[24];
+        char* end = to_chars(digits, digits + sizeof(digits), value).ptr;
+        s.out.insert(s.out.end(), digits, end);
+    }
+
+    void execute(Session& s, const char* line, const char* end) {
+        LineScanner scan(line, end);
+        const char* command;
+        size_t length;
+        if (!scan.word(command, length)) return;
+
+        if (LineScanner::equals(command, length, "quit")) {
+            s.closing = true;
+            return;
+        }
+        if (LineScanner::equals(command, length, "new")) {
+            int n = 0, k = 0;
+            uint64_t gameSeed = seed ^ (++started * 0x9e3779b97f4a7c15ULL);
+            if (!scan.number(n) || (!scan.atEnd() && !scan.number(gameSeed)) ||
+                (!scan.atEnd() && (!scan.number(k) || k < 1)) || !scan.atEnd()) {
+                put(s, "error usage: new N [SEED [K]]\n");
+                return;
             }
-            return true;
-        } catch (const invalid_argument&) {
-            return false;
+            if (n <= 3 || n > maxN) {
+                put(s, "error N must be from 4 to ");
+                put(s, uint64_t(maxN));
+                put(s, '\n');
+                return;
+            }
+            WinRule rule{k, k};
+            if (s.game && s.game->size() == n && s.game->rule().sameAs(rule, n)) {
+                s.game->reset(gameSeed);
+            } else {
+                s.game.reset();
+                try {
+                    s.game.reset(new TicTacToe(n, WinCheck::Counters, gameSeed, rule));
+                } catch (const bad_alloc&) {
+                    put(s, "error out of memory\n");
+                    return;
+                }
+            }
+            put(s, "ok ");
+            put(s, uint64_t(n));
+            put(s, ' ');
+            put(s, gameSeed);
+            put(s, '\n');
+            turn(s);
+            return;
+        }
+        if (!s.game) {
+            put(s, "error no game, send: new N [SEED [K]]\n");
+            return;
+        }
+
+        TicTacToe& game = *s.game;
+        int n = game.size();
+        if (LineScanner::equals(command, length, "move")) {
+            int r, c;
+            if (!scan.number(r) || !scan.number(c) || !scan.atEnd()) {
+                put(s, "error usage: move R C\n");
+                return;
+            }
+            if (game.status() != GameStatus::InProgress) {
+                put(s, "error game over\n");
+                return;
+            }
+            if (r < 0 || r >= n || c < 0 || c >= n) {
+                put(s, "invalid\n");
+                turn(s);
+                return;
+            }
+            char mover = game.toMove();
+            MoveResult result = game.applyMove(Move{game.activeGrid(), r * n + c});
+            if (result == MoveResult::Invalid) put(s, "invalid\n");
+            else if (result == MoveResult::Placed) put(s, "placed\n");
+            else {
+                put(s, "grid ");
+                put(s, mover);
+                put(s, '\n');
+            }
+            turn(s);
+        } else if (LineScanner::equals(command, length, "undo")) {
+            put(s, game.undoMove() ? "ok\n" : "error nothing to undo\n");
+            turn(s);
+        } else if (LineScanner::equals(command, length, "board")) {
+            put(s, "board ");
+            const char* cells = game.cells().grid(0);
+            s.out.insert(s.out.end(), cells, cells + n * n * n * n);
+            put(s, ' ');
+            for (int g = 0; g < n * n; ++g) put(s, game.gridWinner(g / n, g % n));
+            put(s, '\n');
+        } else {
+            put(s, "error unknown command\n");
+        }
+    }
+
+    // Reports whose turn it is, drawing the next active sub-grid as play() does.
+    static void turn(Session& s) {
+        TicTacToe& game = *s.game;
+        GameStatus status = game.status();
+        if (status != GameStatus::InProgress) {
+            put(s, status == GameStatus::XWins ? "over X\n" : status == GameStatus::OWins ? "over O\n" : "over draw\n");
+            return;
         }
+        if (game.activeGrid() < 0) game.drawActiveGrid();
+        int n = game.size();
+        put(s, "turn ");
+        put(s, game.toMove());
+        put(s, ' ');
+        put(s, uint64_t(game.activeGrid() / n));
+        put(s, ' ');
+        put(s, uint64_t(game.activeGrid() % n));
+        put(s, '\n');
     }
 };
 
-int main() {
+// "server": port=, sessions= concurrent connections, maxN= largest board (16).
+int runServer(const Options& args) {
+    signal(SIGPIPE, SIG_IGN);
+    int port = int(args.number("port", 7777));
+    uint64_t seed = args.has("seed") ? uint64_t(args.number("seed", 1)) : uint64_t(time(0));
+    GameServer server(int(args.number("sessions", 10000)), int(args.number("maxN", 16)), seed);
+    if (!server.listen(port)) {
+        cout << "Cannot listen on port " << port << ".\n";
+        return 1;
+    }
+    cout << "Serving on port " << port << ", seed " << seed << "\n";
+    cout.flush();
+    server.run();
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Options args(argc, argv);
+    if (args.has("mcts")) return runMctsScaling(args);
+    if (args.has("selfplay")) return runSelfPlay(args);
+    if (args.has("replay")) return runReplay(args);
+    if (args.has("bench")) return runBench(args);
+    if (args.has("perft")) return runPerft(args);
+    if (args.has("server")) return runServer(args);
+    if (args.has("buildbook")) return runBuildBook(args);
+    if (args.has("analyze")) return runAnalyze(args);
+    if (!validSizeAndThreads(args)) return 1;  // threads= is used by the MCTS player
+
     int n;
     cout << "Enter the size of the board (n > 3): ";
     cin >> n;
-    if (n <= 3) {
-        cout << "Invalid size. Exiting.\n";
+    if (n <= 3 || n > TicTacToe::MaxSize) {
+        cout << "Invalid size (4 to " << TicTacToe::MaxSize << "). Exiting.\n";
         return 0;
     }
 
-    TicTacToe game(n);
-    game.play();
+    // Without seed=, pick one from the clock and show it so the game can be replayed.
+    uint64_t seed = args.has("seed") ? uint64_t(args.number("seed", 1)) : uint64_t(time(0));
+    cout << "Seed: " << seed << "\n";
+    TicTacToe game(n, WinCheck::Counters, seed, winRule(args));
+    PlayOptions options;
+    string aiSide = args.get("ai");
+    if (aiSide == "X" || aiSide == "O") {
+        options.aiSide = aiSide[0];
+        options.limits.maxMillis = int(args.number("ms", 500));
+        options.limits.maxNodes = args.number("nodes", 0);
+        options.limits.maxDepth = int(args.number("depth", options.limits.maxDepth));
+        options.mctsLimits.maxMillis = options.limits.maxMillis;
+        options.mctsLimits.threads = int(args.number("threads", 1));
+        options.mctsLimits.trees = int(args.number("trees", 1));
+    }
+    AIPlayer ai(n, size_t(args.number("tt", 16)));
+    PositionBook book;
+    if (args.has("book")) {
+        if (book.open(args.get("book"), n, game.rule())) ai.useBook(&book);
+        else cout << "Cannot load book " << args.get("book") << " for this n and k, searching every move.\n";
+    }
+    MctsPlayer mcts;
+    options.ai = &ai;
+    if (args.get("engine") == "mcts") options.mcts = &mcts;
+    options.ansiDiff = args.number("diff", 0) != 0;
+    options.bulkInput = args.number("script", 0) != 0;
+    game.play(options);
 
-    return 0;
+    return writeStats(args) ? 0 : 1;
 }